@@ -13,9 +13,9 @@ int main()
 
     std::string url_str;
     std::cin >> url_str;
-    auto res = requests::urldecoded(requests::url(url_str).query);
+    auto code = requests::query_view{requests::url_view{url_str}.query()}.find("code");
 
-    auto token = oauth.access_token(res["code"]);
+    auto token = oauth.access_token(requests::query_view::decoded(code.value_or("")));
     std::cout << token.access_token << "\n";
     std::cout << token.expires_in << "\n";
     std::cout << token.refresh_token << "\n";
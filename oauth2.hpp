@@ -48,7 +48,7 @@ struct oauth2
         std::string scope;
         for (const auto &s : scopes)
         {
-            if (!scope.empty()) { scope += "%20"; }
+            if (!scope.empty()) { scope += " "; }
             scope += s;
         }
 
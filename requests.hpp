@@ -1,131 +1,203 @@
 #pragma once
 
-#include <bitset>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <functional>
+#include <future>
+#include <limits>
 #include <map>
-#include <regex>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
 
 #include <curl/curl.h>
 
+#if defined(__SSE2__)
+    #include <immintrin.h>
+#endif // __SSE2__
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #ifdef REQUESTS_WITH_NLOHMANN_JSON
     #include "nlohmann.hpp"
 #endif // REQUESTS_WITH_NLOHMANN_JSON
 
+#ifdef REQUESTS_WITH_ZLIB
+    #include <zlib.h>
+#endif // REQUESTS_WITH_ZLIB
+
+#ifdef REQUESTS_WITH_ZSTD
+    #include <zstd.h>
+#endif // REQUESTS_WITH_ZSTD
+
 namespace requests {
 
-// Requested URL.
-struct url
-{
-    /* Origin */
-    std::string scheme; // http or https (or empty)
-    std::string host;   // Can't be empty, if port or scheme not empty
-    std::string port;   // In range [0, 65535]
+namespace detail {
 
-    /* Resource */
-    std::string path;     // With leading '/' (if not empty)
-    std::string query;    // Without '?'
-    std::string fragment; // Without '#'
+constexpr bool is_alpha(char c) noexcept { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+constexpr bool is_digit(char c) noexcept { return c >= '0' && c <= '9'; }
+constexpr char to_lower(char c) noexcept { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
 
+constexpr bool iequals(std::string_view lhs, std::string_view rhs) noexcept
+{
+    return std::ranges::equal(lhs, rhs, {}, to_lower, to_lower);
+}
 
-    /* Create URL from string */
-    url(const char *str) noexcept : url(std::string_view{str}) {}
-    url(const std::string &str) noexcept : url(std::string_view{str}) {}
-    url(std::string_view url = "") noexcept
-    {
-        std::cmatch match;
+// Strip optional whitespace (SP / HTAB) around str
+constexpr std::string_view trim_ows(std::string_view str) noexcept
+{
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) { str.remove_prefix(1); }
+    while (!str.empty() && (str.back()  == ' ' || str.back()  == '\t')) { str.remove_suffix(1); }
+    return str;
+}
 
-        // Starts with http(s) followed by :// in any case
-        std::regex rscheme("^(https?)://", std::regex_constants::icase);
+// Split "name: value" on the first colon (RFC 9110), both empty if there's none
+constexpr std::pair<std::string_view, std::string_view> split_header(std::string_view str) noexcept
+{
+    size_t colon = str.find(':');
+    if (colon == std::string_view::npos) { return {}; }
 
-        // Find scheme
-        if (std::regex_search(url.data(), match, rscheme))
-        {
-            // Get scheme without ://
-            scheme = match.str(1);
-            // Convert scheme to lowercase
-            std::ranges::transform(scheme, scheme.begin(), [](char c){ return std::tolower(c); });
-            // Remove found
-            url.remove_prefix(match.str().size());
-        }
+    return { trim_ows(str.substr(0, colon)), trim_ows(str.substr(colon + 1)) };
+}
 
+// URL components as views into the source string
+struct url_parts
+{
+    std::string_view scheme;
+    std::string_view host;
+    std::string_view port;
+    std::string_view path;
+    std::string_view query;
+    std::string_view fragment;
+};
 
-        /* Regex helpers */
-        const std::string hostnumber  {"(([0-9]{1,3}\\.){3}[0-9]{1,3})"};
-        const std::string toplabel    {"([a-z][-a-z0-9]*[a-z0-9])"};
-        const std::string domainlabel {"([a-z0-9][-a-z0-9]*[a-z0-9])"};
-        const std::string hostname    {"((" + domainlabel + "\\.)*" + toplabel + ")"};
+// Single pass RFC 3986 splitter, doesn't allocate
+constexpr url_parts split_url(std::string_view str) noexcept
+{
+    url_parts res;
+    size_t i = 0;
 
-        // Starts with valid host
-        std::regex rhost(
-            "^(" + hostname + "|" + hostnumber + ")",
-            std::regex_constants::icase | std::regex_constants::nosubs
-        );
+    // scheme = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." ), followed by "://"
+    if (!str.empty() && is_alpha(str[0]))
+    {
+        size_t j = 1;
+        while (j < str.size() && (is_alpha(str[j]) || is_digit(str[j]) ||
+                                  str[j] == '+' || str[j] == '-' || str[j] == '.')) { ++j; }
 
-        // Find host
-        if (std::regex_search(url.data(), match, rhost))
+        if (str.substr(j, 3) == "://")
         {
-            // Get host
-            host = match.str();
-            // Convert host to lowercase
-            std::ranges::transform(host, host.begin(), [](char c){ return std::tolower(c); });
-            // Remove found
-            url.remove_prefix(match.str().size());
+            res.scheme = str.substr(0, j);
+            i = j + 3;
         }
+    }
+
+    // Network-path reference ("//host/path")
+    if (res.scheme.empty() && str.starts_with("//")) { i = 2; }
+
+    // Authority is present unless the string starts right away with path, query or fragment
+    if (i < str.size() && (i > 0 || (str[0] != '/' && str[0] != '?' && str[0] != '#')))
+    {
+        size_t end = str.find_first_of("/?#", i);
+        if (end == std::string_view::npos) { end = str.size(); }
 
+        std::string_view authority = str.substr(i, end - i);
+        i = end;
 
-        // Starts with optional port
-        std::regex rport("^(:([0-9]{1,5}))?");
+        // Skip userinfo
+        if (auto at = authority.rfind('@'); at != std::string_view::npos) { authority.remove_prefix(at + 1); }
 
-        // Find port
-        std::regex_search(url.data(), match, rport);
-        if (!match.str().empty())
+        // IP-literal in brackets may contain ':'
+        size_t colon = std::string_view::npos;
+        if (authority.starts_with('['))
+        {
+            size_t close = authority.find(']');
+            close = close == std::string_view::npos ? authority.size() : close + 1;
+            if (close < authority.size() && authority[close] == ':') { colon = close; }
+        }
+        else
         {
-            // Get specified port
-            port = match.str(2);
-            // Remove found
-            url.remove_prefix(match.str().size());
+            colon = authority.rfind(':');
         }
 
+        res.host = authority.substr(0, colon);
+        if (colon != std::string_view::npos) { res.port = authority.substr(colon + 1); }
+    }
 
-        /* Regex helpers */
-        const std::string escape   {"(%[0-9a-f]{2})"};
-        const std::string hsegment {"(([-$_.+;:@&=!*'(),a-z0-9]|" + escape + ")*)"};
+    // path ends with '?' or '#'
+    size_t end = str.find_first_of("?#", i);
+    if (end == std::string_view::npos) { end = str.size(); }
+    res.path = str.substr(i, end - i);
+    i = end;
 
-        // Starts with optional path
-        std::regex rpath(
-            "^(/" + hsegment + ")*",
-            std::regex_constants::icase | std::regex_constants::nosubs
-        );
+    // query ends with '#'
+    if (i < str.size() && str[i] == '?')
+    {
+        end = str.find('#', i);
+        if (end == std::string_view::npos) { end = str.size(); }
+        res.query = str.substr(i + 1, end - i - 1);
+        i = end;
+    }
 
-        // Find path
-        std::regex_search(url.data(), match, rpath);
-        // Get specified path or ""
-        path = match.str();
-        // Remove found
-        url.remove_prefix(match.str().size());
+    // fragment is the rest
+    if (i < str.size()) { res.fragment = str.substr(i + 1); }
 
+    return res;
+}
 
-        // Starts with optional query
-        std::regex rquery("^(?:\\?" + hsegment + ")?", std::regex_constants::icase);
+} // namespace detail
 
-        // Find query
-        std::regex_search(url.data(), match, rquery);
-        // Get specified query or ""
-        query = match.str(1);
-        // Remove found
-        url.remove_prefix(match.str().size());
+// Requested URL.
+struct url
+{
+    /* Origin */
+    std::string scheme; // http or https (or empty)
+    std::string host;   // Can't be empty, if port or scheme not empty
+    std::string port;   // In range [0, 65535]
 
+    /* Resource */
+    std::string path;     // With leading '/' (if not empty)
+    std::string query;    // Without '?'
+    std::string fragment; // Without '#'
 
-        // Starts with optional query
-        std::regex rfragment("^(?:#" + hsegment + ")?", std::regex_constants::icase);
 
-        // Find query
-        std::regex_search(url.data(), match, rfragment);
-        // Get specified query or ""
-        fragment = match.str(1);
-        // Remove found
-        url.remove_prefix(match.str().size());
+    /* Create URL from string */
+    url(const char *str) noexcept : url(std::string_view{str}) {}
+    url(const std::string &str) noexcept : url(std::string_view{str}) {}
+    url(std::string_view url = "") noexcept
+    {
+        auto parts = detail::split_url(url);
+
+        scheme   = parts.scheme;
+        host     = parts.host;
+        port     = parts.port;
+        path     = parts.path;
+        query    = parts.query;
+        fragment = parts.fragment;
+
+        // Scheme and host are case-insensitive
+        std::ranges::transform(scheme, scheme.begin(), detail::to_lower);
+        std::ranges::transform(host,   host.begin(),   detail::to_lower);
     }
 
 
@@ -157,10 +229,108 @@ struct url
     std::string to_string() const noexcept { return origin() + resource(); }
 };
 
+// Non-owning URL, components are views into the source string.
+// Unlike url, scheme and host are returned as written (not lowercased).
+class url_view
+{
+public:
+    constexpr url_view() noexcept = default;
+    constexpr explicit url_view(std::string_view str) noexcept : str_(str)
+    {
+        auto parts = detail::split_url(str);
+
+        scheme_   = locate(parts.scheme);
+        host_     = locate(parts.host);
+        port_     = locate(parts.port);
+        path_     = locate(parts.path);
+        query_    = locate(parts.query);
+        fragment_ = locate(parts.fragment);
+    }
+
+    constexpr std::string_view scheme()   const noexcept { return extract(scheme_); }
+    constexpr std::string_view host()     const noexcept { return extract(host_); }
+    constexpr std::string_view port()     const noexcept { return extract(port_); }
+    constexpr std::string_view path()     const noexcept { return extract(path_); }
+    constexpr std::string_view query()    const noexcept { return extract(query_); }
+    constexpr std::string_view fragment() const noexcept { return extract(fragment_); }
+
+    // [<scheme>://]<host>[:<port>] as written in the source. Empty when the source has
+    // userinfo, which the view can't skip: build the origin from scheme(), host() and port().
+    constexpr std::string_view origin() const noexcept
+    {
+        if (host_.length == 0) { return {}; }
+        if (host_.offset > 0 && str_[host_.offset - 1] == '@') { return {}; }
+
+        size_t end = port_.length ? port_.offset + port_.length : host_.offset + host_.length;
+        return str_.substr(0, end);
+    }
+
+    // <path>[?<query>][#<fragment>]
+    constexpr std::string_view resource() const noexcept { return str_.substr(path_.offset); }
+
+    // Return URL string
+    constexpr std::string_view str() const noexcept { return str_; }
+
+private:
+    struct span
+    {
+        size_t offset = 0;
+        size_t length = 0;
+    };
+
+    constexpr span locate(std::string_view part) const noexcept
+    {
+        if (part.data() == nullptr) { return {}; }
+        return { static_cast<size_t>(part.data() - str_.data()), part.size() };
+    }
+
+    constexpr std::string_view extract(span s) const noexcept { return str_.substr(s.offset, s.length); }
+
+    std::string_view str_;
+
+    span scheme_, host_, port_;
+    span path_, query_, fragment_;
+};
+
+// Name/value pairs kept in insertion order, names may repeat (tag=a&tag=b)
+struct params : std::vector<std::pair<std::string, std::string>>
+{
+    using std::vector<std::pair<std::string, std::string>>::vector;
+    using std::vector<std::pair<std::string, std::string>>::operator[];
+
+    iterator find(std::string_view name) noexcept
+    {
+        return std::ranges::find(*this, name, &value_type::first);
+    }
+
+    const_iterator find(std::string_view name) const noexcept
+    {
+        return std::ranges::find(*this, name, &value_type::first);
+    }
+
+    bool contains(std::string_view name) const noexcept { return find(name) != end(); }
+
+    size_t count(std::string_view name) const noexcept
+    {
+        return static_cast<size_t>(std::ranges::count(*this, name, &value_type::first));
+    }
+
+    // Value of the first pair named name, a new pair is added if there is none
+    std::string & operator[](std::string_view name)
+    {
+        auto it = find(name);
+        if (it == end()) { return emplace_back(name, std::string{}).second; }
+        return it->second;
+    }
+
+    // Adds a pair, even if the name is already there
+    void add(std::string_view name, std::string_view value) { emplace_back(name, value); }
+};
+
 // URL query part (?)
-struct query : std::map<std::string, std::string>
+struct query : params
 {
-    using std::map<std::string, std::string>::map;
+    using params::params;
 };
 
 // URL fragment part (#)
@@ -169,316 +339,2190 @@ struct fragment : std::string
     using std::string::string;
 };
 
-std::string urlencoded(const std::map<std::string, std::string> &kv)
+namespace detail {
+
+// application/x-www-form-urlencoded character of a byte: itself for unreserved ones,
+// '+' for space and 0 for the ones percent-encoded
+constexpr std::array<char, 256> form_chars = []
 {
-    std::string res;
-    for (const auto &[k, v] : kv)
+    std::array<char, 256> res{};
+    for (int c = 0; c < 256; ++c)
     {
-        res += k + "=" + v + "&";
+        if (is_alpha(static_cast<char>(c)) || is_digit(static_cast<char>(c))) { res[c] = static_cast<char>(c); }
     }
-    if (!res.empty()) { res.pop_back(); }
+    for (char c : std::string_view{"*-._"}) { res[static_cast<uint8_t>(c)] = c; }
+    res[' '] = '+';
+    return res;
+}();
+
+// Hex digit to its value, 0xff for other characters
+constexpr std::array<uint8_t, 256> hex_values = []
+{
+    std::array<uint8_t, 256> res{};
+    res.fill(0xff);
+    for (int c = 0; c < 10; ++c) { res['0' + c] = static_cast<uint8_t>(c); }
+    for (int c = 0; c < 6; ++c)  { res['a' + c] = res['A' + c] = static_cast<uint8_t>(10 + c); }
     return res;
+}();
+
+#if defined(__SSE2__)
+// Bit per byte of 16 that is not copied as is when form-encoding. Reads 16 bytes.
+inline unsigned form_escaped_mask(const char *in) noexcept
+{
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+
+    // c in [lo, hi] as a signed comparison, shifted so that lo is the smallest value
+    auto in_range = [](__m128i c, char lo, char hi)
+    {
+        return _mm_cmplt_epi8(_mm_add_epi8(c, _mm_set1_epi8(static_cast<char>(0x80 - lo))),
+                              _mm_set1_epi8(static_cast<char>(-128 + (hi - lo + 1))));
+    };
+
+    __m128i safe = _mm_or_si128(in_range(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 'z'), in_range(c, '0', '9'));
+    safe = _mm_or_si128(safe, _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('*')), _mm_cmpeq_epi8(c, _mm_set1_epi8('-'))));
+    safe = _mm_or_si128(safe, _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('.')), _mm_cmpeq_epi8(c, _mm_set1_epi8('_'))));
+
+    return ~static_cast<unsigned>(_mm_movemask_epi8(safe)) & 0xffff;
+}
+
+// Bit per byte of 16 that is '%' or '+'. Reads 16 bytes.
+inline unsigned form_encoded_mask(const char *in) noexcept
+{
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    return static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('%')), _mm_cmpeq_epi8(c, _mm_set1_epi8('+')))));
 }
+#endif // __SSE2__
 
-std::map<std::string, std::string> urldecoded(std::string_view str)
+// Length of str once form-encoded
+inline size_t form_encoded_size(std::string_view str) noexcept
 {
-    std::map<std::string, std::string> res;
+    size_t res = str.size();
+    size_t i = 0;
 
-    std::string k, v;
-    bool processing_k = true;
-    for (const auto &c : str)
+#if defined(__SSE2__)
+    for (; i + 16 <= str.size(); i += 16)
     {
-        if (c == '=') { processing_k = false; continue; }
-        if (c == '&') { res[k] = v; k = v = ""; processing_k = true; continue; }
-        if (processing_k) { k.push_back(c); }
-        else { v.push_back(c); }
+        for (unsigned escaped = form_escaped_mask(str.data() + i); escaped; escaped &= escaped - 1)
+        {
+            res += form_chars[static_cast<uint8_t>(str[i + std::countr_zero(escaped)])] ? 0 : 2;
+        }
     }
-    if (!k.empty()) { res[k] = v; }
+#endif // __SSE2__
 
+    for (; i < str.size(); ++i) { res += form_chars[static_cast<uint8_t>(str[i])] ? 0 : 2; }
     return res;
 }
 
-// Basic authorization
-struct auth
+// Writes str form-encoded to out, which has form_encoded_size(str) bytes. Returns the end.
+inline char * form_encode(std::string_view str, char *out) noexcept
 {
-    std::string username;
-    std::string password;
+    constexpr std::string_view digits = "0123456789ABCDEF";
 
-    std::string to_base64() const noexcept
+    auto encode = [&out, digits](char c)
     {
-        constexpr std::string_view base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                                                "abcdefghijklmnopqrstuvwxyz"
-                                                                "0123456789+/";
+        if (char e = form_chars[static_cast<uint8_t>(c)]) { *out++ = e; return; }
 
-        std::string msg = username + ":" + password;
-        std::string_view str = msg;
+        *out++ = '%';
+        *out++ = digits[static_cast<uint8_t>(c) >> 4];
+        *out++ = digits[static_cast<uint8_t>(c) & 0xf];
+    };
 
-        std::string res; res.reserve(str.size() * 1.33);
+    size_t i = 0;
 
-        while (str.size() >= 3)
+#if defined(__SSE2__)
+    // Runs of bytes copied as is go 16 at a time
+    for (; i + 16 <= str.size(); i += 16)
+    {
+        if (form_escaped_mask(str.data() + i) == 0)
         {
-            std::string bits; bits.reserve(24);
-            for (size_t i = 0; i < 3; ++i)
-            {
-                bits += std::bitset<8>{static_cast<unsigned long long>(str[i])}.to_string();
-            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_loadu_si128(reinterpret_cast<const __m128i *>(str.data() + i)));
+            out += 16;
+            continue;
+        }
 
-            for (size_t i = 0; i < 4; ++i)
-            {
-                res += base64_chars[std::bitset<6>(bits, i*6).to_ulong()];
-            }
+        for (size_t j = i; j < i + 16; ++j) { encode(str[j]); }
+    }
+#endif // __SSE2__
+
+    for (; i < str.size(); ++i) { encode(str[i]); }
+    return out;
+}
 
-            str.remove_prefix(3);
+// Form-decodes str into out, which has room for str.size() chars, and returns the end of
+// the output: '+' is space and "%XX" the byte, other '%' are kept as they are
+inline char * form_decode(std::string_view str, char *out) noexcept
+{
+    size_t i = 0;
+
+    while (i < str.size())
+    {
+    #if defined(__SSE2__)
+        // Runs without '%' and '+' go 16 at a time
+        if (i + 16 <= str.size() && form_encoded_mask(str.data() + i) == 0)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_loadu_si128(reinterpret_cast<const __m128i *>(str.data() + i)));
+            out += 16;
+            i += 16;
+            continue;
         }
+    #endif // __SSE2__
 
-        if (str.size() == 2)
+        char c = str[i++];
+        if (c == '+') { c = ' '; }
+        else if (c == '%' && i + 2 <= str.size())
         {
-            std::string bits; bits.reserve(18);
-            for (size_t i = 0; i < 2; ++i)
+            uint8_t hi = hex_values[static_cast<uint8_t>(str[i])];
+            uint8_t lo = hex_values[static_cast<uint8_t>(str[i + 1])];
+            if (hi != 0xff && lo != 0xff)
             {
-                bits += std::bitset<8>{static_cast<unsigned long long>(str[i])}.to_string();
+                c = static_cast<char>(hi << 4 | lo);
+                i += 2;
             }
-            bits += "00";
+        }
+        *out++ = c;
+    }
+    return out;
+}
+
+// Form-decoded copy of str
+inline std::string form_decoded(std::string_view str)
+{
+    std::string res(str.size(), '\0');
+    res.resize(static_cast<size_t>(form_decode(str, res.data()) - res.data()));
+    return res;
+}
+
+// Whether form-encoded encoded is plain once decoded, without decoding it
+constexpr bool form_equals(std::string_view encoded, std::string_view plain) noexcept
+{
+    size_t i = 0;
+    for (char p : plain)
+    {
+        if (i == encoded.size()) { return false; }
 
-            for (size_t i = 0; i < 3; ++i)
+        char c = encoded[i++];
+        if (c == '+') { c = ' '; }
+        else if (c == '%' && i + 2 <= encoded.size())
+        {
+            uint8_t hi = hex_values[static_cast<uint8_t>(encoded[i])];
+            uint8_t lo = hex_values[static_cast<uint8_t>(encoded[i + 1])];
+            if (hi != 0xff && lo != 0xff)
             {
-                res += base64_chars[std::bitset<6>(bits, i*6).to_ulong()];
+                c = static_cast<char>(hi << 4 | lo);
+                i += 2;
             }
-            res += "=";
         }
-        else if (str.size() == 1)
+        if (c != p) { return false; }
+    }
+    return i == encoded.size();
+}
+
+} // namespace detail
+
+// Pairs of an application/x-www-form-urlencoded string, split lazily over the string (which must
+// outlive the view) without allocating. Names and values are still encoded, see decoded().
+class query_view
+{
+public:
+    using value_type = std::pair<std::string_view, std::string_view>;
+
+    class iterator
+    {
+    public:
+        using value_type = query_view::value_type;
+        using difference_type = std::ptrdiff_t;
+
+        constexpr iterator() noexcept = default; // End of any view
+        constexpr explicit iterator(std::string_view rest) noexcept : rest_(rest), done_(false) { next(); }
+
+        constexpr const value_type & operator*() const noexcept { return pair_; }
+        constexpr const value_type * operator->() const noexcept { return &pair_; }
+
+        constexpr iterator & operator++() noexcept { next(); return *this; }
+        constexpr iterator operator++(int) noexcept { auto res = *this; next(); return res; }
+
+        constexpr bool operator==(const iterator &other) const noexcept
         {
-            std::string bits {std::bitset<8>{static_cast<unsigned long long>(str[0])}.to_string() + "0000"};
+            return done_ == other.done_ && rest_.data() == other.rest_.data();
+        }
 
-            for (size_t i = 0; i < 2; ++i)
+    private:
+        // Skips empty pairs, a name without '=' has an empty value
+        constexpr void next() noexcept
+        {
+            while (!rest_.empty())
             {
-                res += base64_chars[std::bitset<6>(bits, i*6).to_ulong()];
+                size_t end = rest_.find('&');
+                std::string_view pair = rest_.substr(0, end);
+                rest_.remove_prefix(end == std::string_view::npos ? rest_.size() : end + 1);
+
+                if (pair.empty()) { continue; }
+
+                size_t eq = pair.find('=');
+                pair_ = { pair.substr(0, eq), eq == std::string_view::npos ? std::string_view{} : pair.substr(eq + 1) };
+                return;
             }
-            res += "==";
+            done_ = true;
+            rest_ = {};
         }
 
-        return res;
-    }
-};
-
-// Bearer token authorization
-struct bearer
-{
-    std::string token;
-};
+        std::string_view rest_;
+        value_type pair_;
+        bool done_ = true;
+    };
 
-// Single HTTP-header
-struct header
-{
-    std::string name;
-    std::string value;
+    constexpr query_view() noexcept = default;
+    constexpr explicit query_view(std::string_view str) noexcept : str_(str) {}
 
-    std::string to_string() const { return name + ": " + value; }
+    constexpr iterator begin() const noexcept { return iterator{str_}; }
+    constexpr iterator end() const noexcept { return iterator{}; }
 
-    static header parse(std::string_view str)
+    // Value (still encoded) of the first pair named name once decoded
+    constexpr std::optional<std::string_view> find(std::string_view name) const noexcept
     {
-        header res;
-        std::cmatch match;
-        std::regex r("(.*): (.*)");
-        if (std::regex_search(str.data(), match, r))
+        for (const auto &[n, v] : *this)
         {
-            res.name = match.str(1);
-            res.value = match.str(2);
+            if (detail::form_equals(n, name)) { return v; }
         }
-        return res;
+        return std::nullopt;
     }
-};
 
+    constexpr bool contains(std::string_view name) const noexcept { return find(name).has_value(); }
 
-namespace comparators {
+    // Decoded part, which is part itself when there is nothing to decode,
+    // otherwise decoded into buffer (reusing its capacity)
+    static std::string_view decoded(std::string_view part, std::string &buffer)
+    {
+        if (part.find_first_of("%+") == std::string_view::npos) { return part; }
 
-struct case_insensitive_less
+        buffer.resize(part.size());
+        buffer.resize(static_cast<size_t>(detail::form_decode(part, buffer.data()) - buffer.data()));
+        return buffer;
+    }
+
+    static std::string decoded(std::string_view part) { return detail::form_decoded(part); }
+
+    constexpr std::string_view str() const noexcept { return str_; }
+
+private:
+    std::string_view str_;
+};
+
+// Pairs as application/x-www-form-urlencoded in their order, sized before encoding
+template<std::ranges::forward_range Pairs>
+std::string urlencoded(const Pairs &kv)
 {
-    constexpr bool operator()(std::string_view lhs, std::string_view rhs) const noexcept
-    {
-        if (lhs.size() < rhs.size()) { return true; }
-        if (lhs.size() > rhs.size()) { return false; }
+    if (std::ranges::empty(kv)) { return {}; }
 
-        for (size_t i = 0; i < lhs.size(); ++i)
-        {
-            if (std::tolower(lhs[i]) < std::tolower(rhs[i])) { return true; }
-            if (std::tolower(lhs[i]) > std::tolower(rhs[i])) { return false; }
-        }
+    size_t size = static_cast<size_t>(std::ranges::distance(kv)) * 2 - 1;
+    for (const auto &[k, v] : kv) { size += detail::form_encoded_size(k) + detail::form_encoded_size(v); }
 
-        return false;
+    std::string res(size, '\0');
+    char *out = res.data();
+    for (const auto &[k, v] : kv)
+    {
+        if (out != res.data()) { *out++ = '&'; }
+        out = detail::form_encode(k, out);
+        *out++ = '=';
+        out = detail::form_encode(v, out);
     }
-};
 
-} // namespace Comparators
+    return res;
+}
 
-// Multiple HTTP-headers
-struct headers : std::map<std::string, std::string, comparators::case_insensitive_less>
+// Pairs of application/x-www-form-urlencoded str in their order. Empty pairs are skipped
+// and a name without '=' has an empty value.
+inline params urldecoded(std::string_view str)
 {
-    using std::map<std::string, std::string, comparators::case_insensitive_less>::map;
+    params res;
+    res.reserve(static_cast<size_t>(std::ranges::count(str, '&')) + 1);
+    for (const auto &[k, v] : query_view{str}) { res.emplace_back(query_view::decoded(k), query_view::decoded(v)); }
+    return res;
+}
 
-    void insert(const header &h) { map::insert({h.name, h.value}); }
-};
+namespace detail {
 
-// URL-encoded data
-struct data : std::map<std::string, std::string>
+constexpr std::string_view base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                          "abcdefghijklmnopqrstuvwxyz"
+                                          "0123456789+/";
+
+// Character to 6-bit value, 0xff for characters outside the alphabet
+constexpr std::array<uint8_t, 256> base64_values = []
 {
-    using std::map<std::string, std::string>::map;
-};
+    std::array<uint8_t, 256> res{};
+    res.fill(0xff);
+    for (size_t i = 0; i < base64_chars.size(); ++i) { res[static_cast<uint8_t>(base64_chars[i])] = i; }
+    return res;
+}();
 
-#ifdef REQUESTS_WITH_NLOHMANN_JSON
-// JSON data
-using json = nlohmann::json;
-#else
-// JSON data
-struct json : std::string
+#if defined(__SSSE3__)
+// 12 bytes of input to 16 characters. Reads 16 bytes.
+// See W. Muła, D. Lemire "Faster Base64 Encoding and Decoding Using AVX2 Instructions".
+inline __m128i base64_encode_block(__m128i in) noexcept
 {
-    using std::string::string;
-};
-#endif // REQUESTS_WITH_NLOHMANN_JSON
+    // Spread each 3 bytes over 4 lanes, then move every 6 bits into its own byte
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
 
-// Plain text
-struct text : std::string
+    __m128i hi = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i lo = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(hi, lo);
+
+    // Offset from the 6-bit value to its character, picked by value range
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+#endif // __SSSE3__
+
+#if defined(__AVX2__)
+// Two blocks of base64_encode_block at once, 24 bytes to 32 characters. Reads 28 bytes.
+inline __m256i base64_encode_block(__m256i in) noexcept
 {
-    using std::string::string;
-};
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
 
+    __m256i hi = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+    __m256i lo = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(hi, lo);
 
-namespace concepts {
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
 
-// One of Request's options
-template<typename T>
-concept option = std::same_as<T, auth>     ||
-                 std::same_as<T, data>     ||
-                 std::same_as<T, fragment> ||
-                 std::same_as<T, header>   ||
-                 std::same_as<T, headers>  ||
-                 std::same_as<T, json>     ||
-                 std::same_as<T, query>    ||
-                 std::same_as<T, text>;
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0);
 
-} // namespace concepts
+    return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+}
+#endif // __AVX2__
 
-// Request's method
-enum class method {
-    DELETE,
-    GET,
-    HEAD,
-    POST,
-    PUT,
-    OPTIONS,
-    PATCH,
-};
+} // namespace detail
 
-struct request
+// Standard base64 (RFC 4648) with padding
+inline std::string base64_encode(std::string_view str)
 {
-    requests::method  method;
-    requests::url     target;
-    requests::headers headers;
-    std::string body;
+    std::string res((str.size() + 2) / 3 * 4, '\0');
 
+    auto in  = reinterpret_cast<const uint8_t *>(str.data());
+    auto end = in + str.size();
+    char *out = res.data();
 
-    /* Helper setters */
-    template<concepts::option T, concepts::option ...Ts>
-    void set(const T &t, const Ts & ...ts) noexcept { set(t); set(ts...); }
-    void set() noexcept {}
+#if defined(__AVX2__)
+    for (; end - in >= 28; in += 24, out += 32)
+    {
+        __m256i block = _mm256_set_m128i(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 12)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(in)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), detail::base64_encode_block(block));
+    }
+#endif // __AVX2__
+
+#if defined(__SSSE3__)
+    for (; end - in >= 16; in += 12, out += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), detail::base64_encode_block(block));
+    }
+#endif // __SSSE3__
+
+    for (; end - in >= 3; in += 3)
+    {
+        uint32_t bits = (in[0] << 16) | (in[1] << 8) | in[2];
+        *out++ = detail::base64_chars[(bits >> 18) & 0x3f];
+        *out++ = detail::base64_chars[(bits >> 12) & 0x3f];
+        *out++ = detail::base64_chars[(bits >> 6)  & 0x3f];
+        *out++ = detail::base64_chars[bits & 0x3f];
+    }
+
+    if (end - in == 2)
+    {
+        uint32_t bits = (in[0] << 16) | (in[1] << 8);
+        *out++ = detail::base64_chars[(bits >> 18) & 0x3f];
+        *out++ = detail::base64_chars[(bits >> 12) & 0x3f];
+        *out++ = detail::base64_chars[(bits >> 6)  & 0x3f];
+        *out++ = '=';
+    }
+    else if (end - in == 1)
+    {
+        uint32_t bits = in[0] << 16;
+        *out++ = detail::base64_chars[(bits >> 18) & 0x3f];
+        *out++ = detail::base64_chars[(bits >> 12) & 0x3f];
+        *out++ = '=';
+        *out++ = '=';
+    }
+
+    return res;
+}
+
+// Inverse of base64_encode, nullopt if str isn't valid padded base64
+inline std::optional<std::string> base64_decode(std::string_view str)
+{
+    if (str.size() % 4 != 0) { return std::nullopt; }
+
+    size_t padding = str.ends_with("==") ? 2 : str.ends_with('=') ? 1 : 0;
+
+    std::string res(str.size() / 4 * 3 - padding, '\0');
+    char *out = res.data();
+
+    for (size_t i = 0; i < str.size(); i += 4)
+    {
+        bool last = i + 4 == str.size();
+
+        uint32_t bits = 0;
+        for (size_t j = 0; j < 4; ++j)
+        {
+            uint8_t v = detail::base64_values[static_cast<uint8_t>(str[i + j])];
+            if (last && j >= 4 - padding) { v = 0; }
+            else if (v == 0xff) { return std::nullopt; }
+
+            bits = (bits << 6) | v;
+        }
+
+        *out++ = static_cast<char>(bits >> 16);
+        if (!last || padding < 2) { *out++ = static_cast<char>(bits >> 8); }
+        if (!last || padding < 1) { *out++ = static_cast<char>(bits); }
+    }
+
+    return res;
+}
+
+// Basic authorization
+struct auth
+{
+    std::string username;
+    std::string password;
+
+    std::string to_base64() const noexcept { return base64_encode(username + ":" + password); }
+
+    bool operator==(const auth &) const = default;
+};
+
+// Bearer token authorization
+struct bearer
+{
+    std::string token;
+
+    bool operator==(const bearer &) const = default;
+};
+
+// Single HTTP-header
+struct header
+{
+    std::string name;
+    std::string value;
+
+    std::string to_string() const { return name + ": " + value; }
+
+    static header parse(std::string_view str)
+    {
+        auto [name, value] = detail::split_header(str);
+        return { std::string{name}, std::string{value} };
+    }
+};
+
+
+namespace comparators {
+
+struct case_insensitive_less
+{
+    constexpr bool operator()(std::string_view lhs, std::string_view rhs) const noexcept
+    {
+        if (lhs.size() < rhs.size()) { return true; }
+        if (lhs.size() > rhs.size()) { return false; }
+
+        for (size_t i = 0; i < lhs.size(); ++i)
+        {
+            if (std::tolower(lhs[i]) < std::tolower(rhs[i])) { return true; }
+            if (std::tolower(lhs[i]) > std::tolower(rhs[i])) { return false; }
+        }
+
+        return false;
+    }
+};
+
+} // namespace Comparators
+
+// Well-known header names, interned by requests::headers
+enum class field : uint8_t
+{
+    unknown,
+    accept,
+    accept_charset,
+    accept_encoding,
+    accept_language,
+    accept_ranges,
+    access_control_allow_origin,
+    age,
+    allow,
+    authorization,
+    cache_control,
+    connection,
+    content_disposition,
+    content_encoding,
+    content_language,
+    content_length,
+    content_location,
+    content_range,
+    content_type,
+    cookie,
+    date,
+    etag,
+    expect,
+    expires,
+    host,
+    if_match,
+    if_modified_since,
+    if_none_match,
+    if_range,
+    if_unmodified_since,
+    keep_alive,
+    last_modified,
+    link,
+    location,
+    origin,
+    pragma,
+    proxy_authenticate,
+    proxy_authorization,
+    range,
+    referer,
+    retry_after,
+    server,
+    set_cookie,
+    strict_transport_security,
+    te,
+    trailer,
+    transfer_encoding,
+    upgrade,
+    user_agent,
+    vary,
+    via,
+    www_authenticate,
+    x_forwarded_for,
+    x_requested_with
+};
+
+namespace detail {
+
+// Lowercase names, indexed by field
+constexpr std::array<std::string_view, 54> field_names = {
+    "",
+    "accept", "accept-charset", "accept-encoding", "accept-language", "accept-ranges",
+    "access-control-allow-origin", "age", "allow", "authorization", "cache-control", "connection",
+    "content-disposition", "content-encoding", "content-language", "content-length",
+    "content-location", "content-range", "content-type", "cookie", "date", "etag", "expect",
+    "expires", "host", "if-match", "if-modified-since", "if-none-match", "if-range",
+    "if-unmodified-since", "keep-alive", "last-modified", "link", "location", "origin", "pragma",
+    "proxy-authenticate", "proxy-authorization", "range", "referer", "retry-after", "server",
+    "set-cookie", "strict-transport-security", "te", "trailer", "transfer-encoding", "upgrade",
+    "user-agent", "vary", "via", "www-authenticate", "x-forwarded-for", "x-requested-with"
+};
+
+// Perfect hash of the well-known names, from length, first, middle and last characters
+constexpr size_t field_slot(std::string_view name) noexcept
+{
+    return (name.size() + to_lower(name.front()) * 24 + to_lower(name[name.size() / 2]) * 3 +
+            to_lower(name.back())) % 256;
+}
+
+constexpr std::array<field, 256> field_slots = []
+{
+    std::array<field, 256> res{};
+    for (size_t i = 1; i < field_names.size(); ++i) { res[field_slot(field_names[i])] = static_cast<field>(i); }
+    return res;
+}();
+
+static_assert(std::ranges::count_if(field_slots, [](field f) { return f != field::unknown; }) ==
+              field_names.size() - 1, "field_slot must not collide on well-known names");
+
+} // namespace detail
+
+// Well-known field of the name (any case) or field::unknown, without allocating
+constexpr field to_field(std::string_view name) noexcept
+{
+    if (name.empty()) { return field::unknown; }
+
+    field f = detail::field_slots[detail::field_slot(name)];
+    return detail::iequals(detail::field_names[static_cast<size_t>(f)], name) ? f : field::unknown;
+}
+
+constexpr std::string_view to_string(field f) noexcept { return detail::field_names[static_cast<size_t>(f)]; }
+
+// Multiple HTTP-headers. Flat, case-insensitive and kept in insertion order.
+// The first 16 headers are stored inline. Each name has a key: the field for well-known
+// names (stored in lowercase), otherwise a hash. Names are compared only when keys match.
+class headers
+{
+public:
+    using value_type     = std::pair<std::string, std::string>;
+    using iterator       = value_type *;
+    using const_iterator = const value_type *;
+
+    headers() noexcept = default;
+    headers(std::initializer_list<value_type> hs)
+    {
+        for (const auto &[name, value] : hs) { try_emplace(name, value); }
+    }
+
+    headers(const headers &) = default;
+    headers & operator=(const headers &) = default;
+
+    // The source is left empty, its size and storage mode go with the entries
+    headers(headers &&other) noexcept
+        : size_(std::exchange(other.size_, 0)),
+          heap_(std::exchange(other.heap_, false)),
+          inline_entries_(std::move(other.inline_entries_)),
+          inline_keys_(other.inline_keys_),
+          heap_entries_(std::move(other.heap_entries_)),
+          heap_keys_(std::move(other.heap_keys_))
+    {
+        other.heap_entries_.clear();
+        other.heap_keys_.clear();
+    }
+
+    headers & operator=(headers &&other) noexcept
+    {
+        if (this != &other)
+        {
+            size_ = std::exchange(other.size_, 0);
+            heap_ = std::exchange(other.heap_, false);
+            inline_entries_ = std::move(other.inline_entries_);
+            inline_keys_ = other.inline_keys_;
+            heap_entries_ = std::move(other.heap_entries_);
+            heap_keys_ = std::move(other.heap_keys_);
+            other.heap_entries_.clear();
+            other.heap_keys_.clear();
+        }
+        return *this;
+    }
+
+    iterator begin() noexcept { return data(); }
+    iterator end()   noexcept { return data() + size_; }
+    const_iterator begin() const noexcept { return data(); }
+    const_iterator end()   const noexcept { return data() + size_; }
+
+    size_t size()  const noexcept { return size_; }
+    bool   empty() const noexcept { return size_ == 0; }
+
+    iterator find(std::string_view name) noexcept
+    {
+        return begin() + std::as_const(*this).index_of(name);
+    }
+
+    const_iterator find(std::string_view name) const noexcept
+    {
+        return begin() + index_of(name);
+    }
+
+    iterator       find(field f)       noexcept { return begin() + std::as_const(*this).index_of(f); }
+    const_iterator find(field f) const noexcept { return begin() + index_of(f); }
+
+    bool   contains(std::string_view name) const noexcept { return find(name) != end(); }
+    bool   contains(field f)               const noexcept { return find(f) != end(); }
+    size_t count(std::string_view name)    const noexcept { return contains(name) ? 1 : 0; }
+
+    std::string & at(std::string_view name)
+    {
+        auto it = find(name);
+        if (it == end()) { throw std::out_of_range("requests::headers::at"); }
+        return it->second;
+    }
+
+    const std::string & at(std::string_view name) const
+    {
+        auto it = find(name);
+        if (it == end()) { throw std::out_of_range("requests::headers::at"); }
+        return it->second;
+    }
+
+    // Add the header unless there is one with that name already
+    std::pair<iterator, bool> try_emplace(std::string_view name, std::string_view value = {})
+    {
+        if (field f = to_field(name); f != field::unknown) { return try_emplace(f, value); }
+
+        uint32_t h = hash(name);
+        if (auto i = index_of(name, h); i != size_) { return { begin() + i, false }; }
+
+        return { append(name, value, h), true };
+    }
+
+    std::pair<iterator, bool> try_emplace(field f, std::string_view value = {})
+    {
+        if (auto i = index_of(f); i != size_) { return { begin() + i, false }; }
+
+        return { append(to_string(f), value, static_cast<uint32_t>(f)), true };
+    }
+
+    std::string & operator[](std::string_view name) { return try_emplace(name).first->second; }
+    std::string & operator[](field f)               { return try_emplace(f).first->second; }
+
+    bool operator==(const headers &other) const noexcept { return std::ranges::equal(*this, other); }
+
+    void insert(const header &h) { try_emplace(h.name, h.value); }
+
+    size_t erase(std::string_view name)
+    {
+        size_t i = index_of(name);
+        if (i == size_) { return 0; }
+
+        std::move(begin() + i + 1, end(), begin() + i);
+        std::move(keys() + i + 1, keys() + size_, keys() + i);
+        --size_;
+
+        if (heap_)
+        {
+            heap_entries_.pop_back();
+            heap_keys_.pop_back();
+        }
+        else
+        {
+            inline_entries_[size_] = {};
+        }
+        return 1;
+    }
+
+    void clear() noexcept
+    {
+        for (size_t i = 0; i < size_ && !heap_; ++i) { inline_entries_[i] = {}; }
+        heap_entries_.clear();
+        heap_keys_.clear();
+        heap_ = false;
+        size_ = 0;
+    }
+
+private:
+    iterator append(std::string_view name, std::string_view value, uint32_t key)
+    {
+        // Move to the heap once the inline storage is full
+        if (!heap_ && size_ == inline_entries_.size())
+        {
+            heap_entries_.reserve(2 * size_);
+            heap_keys_.reserve(2 * size_);
+            for (size_t i = 0; i < size_; ++i)
+            {
+                heap_entries_.push_back(std::move(inline_entries_[i]));
+                heap_keys_.push_back(inline_keys_[i]);
+                inline_entries_[i] = {};
+            }
+            heap_ = true;
+        }
+
+        if (heap_)
+        {
+            heap_entries_.emplace_back(name, value);
+            heap_keys_.push_back(key);
+        }
+        else
+        {
+            inline_entries_[size_].first.assign(name);
+            inline_entries_[size_].second.assign(value);
+            inline_keys_[size_] = key;
+        }
+
+        ++size_;
+        return end() - 1;
+    }
+
+    // FNV-1a of the lowercase name, kept clear of the field keys
+    static constexpr uint32_t hash(std::string_view name) noexcept
+    {
+        uint32_t h = 2166136261u;
+        for (char c : name) { h = (h ^ static_cast<uint8_t>(detail::to_lower(c))) * 16777619u; }
+        return h | 0x100;
+    }
+
+    size_t index_of(std::string_view name) const noexcept
+    {
+        if (field f = to_field(name); f != field::unknown) { return index_of(f); }
+        return index_of(name, hash(name));
+    }
+
+    size_t index_of(std::string_view name, uint32_t h) const noexcept
+    {
+        const uint32_t *ks = keys();
+        for (size_t i = 0; i < size_; ++i)
+        {
+            if (ks[i] == h && detail::iequals(data()[i].first, name)) { return i; }
+        }
+        return size_;
+    }
+
+    size_t index_of(field f) const noexcept
+    {
+        const uint32_t *ks = keys();
+        return std::find(ks, ks + size_, static_cast<uint32_t>(f)) - ks;
+    }
+
+    value_type *       data()       noexcept { return heap_ ? heap_entries_.data() : inline_entries_.data(); }
+    const value_type * data() const noexcept { return heap_ ? heap_entries_.data() : inline_entries_.data(); }
+    uint32_t *         keys()       noexcept { return heap_ ? heap_keys_.data() : inline_keys_.data(); }
+    const uint32_t *   keys() const noexcept { return heap_ ? heap_keys_.data() : inline_keys_.data(); }
+
+    size_t size_ = 0;
+    bool heap_ = false;
+
+    std::array<value_type, 16> inline_entries_;
+    std::array<uint32_t, 16>   inline_keys_{};
+
+    std::vector<value_type> heap_entries_;
+    std::vector<uint32_t>   heap_keys_;
+};
+
+// Form data
+struct data : params
+{
+    using params::params;
+};
+
+#ifdef REQUESTS_WITH_NLOHMANN_JSON
+// JSON data
+using json = nlohmann::json;
+#else
+// JSON data
+struct json : std::string
+{
+    using std::string::string;
+    explicit json(std::string str) noexcept : std::string(std::move(str)) {}
+};
+#endif // REQUESTS_WITH_NLOHMANN_JSON
+
+// Plain text
+struct text : std::string
+{
+    using std::string::string;
+    explicit text(std::string str) noexcept : std::string(std::move(str)) {}
+};
+
+// Response body consumer. Receives the body chunk by chunk instead of response::text,
+// returning false aborts the transfer. Called from the event loop thread for async sends.
+struct on_chunk : std::function<bool(std::string_view)>
+{
+    using std::function<bool(std::string_view)>::function;
+};
+
+// Body consumer writing straight to a file descriptor
+inline on_chunk to_fd(int fd)
+{
+    return [fd](std::string_view chunk)
+    {
+        while (!chunk.empty())
+        {
+            auto n = write(fd, chunk.data(), chunk.size());
+            if (n < 0 && errno == EINTR) { continue; }
+            if (n <= 0) { return false; }
+            chunk.remove_prefix(static_cast<size_t>(n));
+        }
+        return true;
+    };
+}
+
+namespace detail {
+
+// Owned file descriptor
+class file_descriptor
+{
+public:
+    explicit file_descriptor(int fd) noexcept : fd_(fd) {}
+
+    file_descriptor(const file_descriptor &) = delete;
+    void operator=(const file_descriptor &) = delete;
+
+    ~file_descriptor() { if (fd_ >= 0) { close(fd_); } }
+
+    int get() const noexcept { return fd_; }
+
+private:
+    int fd_;
+};
+
+// Read-only private mapping of a whole file
+class mapped_file
+{
+public:
+    explicit mapped_file(const std::string &path) noexcept
+    {
+        file_descriptor file(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (file.get() < 0) { return; }
+
+        struct stat st;
+        if (fstat(file.get(), &st) != 0 || !S_ISREG(st.st_mode)) { return; }
+
+        ok_ = true;
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) { return; }
+
+        void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file.get(), 0);
+        if (data == MAP_FAILED) { ok_ = false; size_ = 0; return; }
+
+        data_ = static_cast<const char *>(data);
+        madvise(data, size_, MADV_SEQUENTIAL);
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    void operator=(const mapped_file &) = delete;
+
+    ~mapped_file() { if (data_) { munmap(const_cast<char *>(data_), size_); } }
+
+    bool ok() const noexcept { return ok_; }
+    std::string_view view() const noexcept { return { data_, size_ }; }
+
+private:
+    bool ok_ = false;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+} // namespace detail
+
+// Request body pulled chunk by chunk while uploading. Sent chunked if the size is unknown.
+// Called from the event loop thread for async sends.
+struct body_source
+{
+    // Fills the buffer and returns the number of bytes written, 0 at the end, nullopt on error
+    std::function<std::optional<size_t>(std::span<char>)> read;
+    std::optional<size_t> size = std::nullopt;
+
+    // Whole body when it's already in memory, lets POST send it without copying.
+    // Stays valid as long as read does.
+    std::string_view region = {};
+
+    // Reads from a descriptor owned by the caller
+    static body_source fd(int from, std::optional<size_t> size = std::nullopt)
+    {
+        return { [from](std::span<char> buffer) -> std::optional<size_t>
+        {
+            while (true)
+            {
+                auto n = ::read(from, buffer.data(), buffer.size());
+                if (n < 0 && errno == EINTR) { continue; }
+                if (n < 0) { return std::nullopt; }
+                return static_cast<size_t>(n);
+            }
+        }, size };
+    }
+
+    // Opens and reads the whole file, failing the transfer if it can't be opened
+    static body_source file(const std::string &path)
+    {
+        auto file = std::make_shared<detail::file_descriptor>(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (file->get() < 0) { return { [](std::span<char>) { return std::optional<size_t>{}; } }; }
+
+        std::optional<size_t> size;
+        if (struct stat st; fstat(file->get(), &st) == 0 && S_ISREG(st.st_mode)) { size = st.st_size; }
+
+        auto source = fd(file->get(), size);
+        return { [file, read = std::move(source.read)](std::span<char> buffer) { return read(buffer); }, size };
+    }
+
+    // Reads from memory (e.g. a mapped region) that must outlive the transfer
+    static body_source memory(std::string_view region)
+    {
+        return { [region](std::span<char> buffer) mutable -> std::optional<size_t>
+        {
+            size_t n = std::min(buffer.size(), region.size());
+            std::copy_n(region.data(), n, buffer.data());
+            region.remove_prefix(n);
+            return n;
+        }, region.size(), region };
+    }
+
+    // Maps the file into memory, failing the transfer if it can't be mapped.
+    // The file must not be truncated while uploading.
+    static body_source mapped(const std::string &path)
+    {
+        auto file = std::make_shared<detail::mapped_file>(path);
+        if (!file->ok()) { return { [](std::span<char>) { return std::optional<size_t>{}; } }; }
+
+        auto source = memory(file->view());
+        return { [file, read = std::move(source.read)](std::span<char> buffer) { return read(buffer); },
+                 source.size, source.region };
+    }
+};
+
+// Upload a file through a memory mapping instead of reading it into request::body
+struct file_body
+{
+    std::string path;
+};
+
+#ifdef REQUESTS_WITH_ZSTD
+// Digested zstd dictionary, shared by the requests compressed with it.
+// The server must know the same dictionary to decode them.
+class zstd_dictionary
+{
+public:
+    explicit zstd_dictionary(std::string_view dictionary, int level = ZSTD_CLEVEL_DEFAULT)
+        : dict_(ZSTD_createCDict(dictionary.data(), dictionary.size(), level)) {}
+
+    zstd_dictionary(const zstd_dictionary &) = delete;
+    void operator=(const zstd_dictionary &) = delete;
+
+    ~zstd_dictionary() { ZSTD_freeCDict(dict_); }
+
+    const ZSTD_CDict * get() const noexcept { return dict_; }
+
+private:
+    ZSTD_CDict *dict_;
+};
+#endif // REQUESTS_WITH_ZSTD
+
+// Compress the request body and set Content-Encoding. Algorithms come with REQUESTS_WITH_ZLIB
+// (gzip) and REQUESTS_WITH_ZSTD (zstd). Body sources are compressed as read and sent chunked.
+struct compression
+{
+    enum algorithm : uint8_t
+    {
+    #ifdef REQUESTS_WITH_ZLIB
+        gzip,
+    #endif // REQUESTS_WITH_ZLIB
+    #ifdef REQUESTS_WITH_ZSTD
+        zstd,
+    #endif // REQUESTS_WITH_ZSTD
+    };
+
+    algorithm algo;
+    int level = 0; // 0 for the algorithm's default
+
+#ifdef REQUESTS_WITH_ZSTD
+    // zstd only, its level is used instead of the one above
+    std::shared_ptr<const zstd_dictionary> dictionary = {};
+#endif // REQUESTS_WITH_ZSTD
+};
+
+
+namespace concepts {
+
+// One of Request's options
+template<typename T>
+concept option_type = std::same_as<T, auth>        ||
+                      std::same_as<T, bearer>      ||
+                      std::same_as<T, body_source> ||
+                      std::same_as<T, compression> ||
+                      std::same_as<T, data>        ||
+                      std::same_as<T, file_body>   ||
+                      std::same_as<T, fragment>    ||
+                      std::same_as<T, header>      ||
+                      std::same_as<T, headers>     ||
+                      std::same_as<T, json>        ||
+                      std::same_as<T, on_chunk>    ||
+                      std::same_as<T, query>       ||
+                      std::same_as<T, text>;
+
+// Option as passed on by a setter or verb, possibly a reference
+template<typename T>
+concept option = option_type<std::remove_cvref_t<T>>;
+
+} // namespace concepts
+
+// Request's method
+enum class method {
+    DELETE,
+    GET,
+    HEAD,
+    POST,
+    PUT,
+    OPTIONS,
+    PATCH,
+};
+
+struct request
+{
+    requests::method  method;
+    requests::url     target;
+    requests::headers headers;
+    std::string body;
+    requests::on_chunk on_chunk = {}; // Empty to collect the body into response::text
+    requests::body_source body_source = {}; // Empty to send body
+    std::optional<requests::compression> compression = {}; // Applied when sent
+
+
+    /* Helper setters */
+    template<concepts::option T, concepts::option ...Ts> requires (sizeof...(Ts) > 0)
+    void set(T &&t, Ts && ...ts) noexcept { set(std::forward<T>(t)); set(std::forward<Ts>(ts)...); }
+    void set() noexcept {}
+
+    void set(const requests::headers &hs) noexcept { headers = hs; }
+    void set(requests::headers &&hs) noexcept { headers = std::move(hs); }
+    void set(const query    &q) noexcept { target.query = urlencoded(q); }
+    void set(const fragment &f) noexcept { target.fragment = f; }
+    void set(fragment &&f) noexcept { target.fragment = std::move(f); }
+    void set(const auth     &a) noexcept { headers[field::authorization] = "Basic " + a.to_base64(); }
+    void set(const bearer   &b) noexcept { headers[field::authorization] = "Bearer " + b.token; }
+    void set(const header   &h) noexcept { headers[h.name] = h.value; }
+    void set(header &&h) noexcept { headers[h.name] = std::move(h.value); }
+    void set(const requests::on_chunk &c) noexcept { on_chunk = c; }
+    void set(requests::on_chunk &&c) noexcept { on_chunk = std::move(c); }
+    void set(const requests::body_source &b) noexcept { set(requests::body_source{b}); }
+    void set(requests::body_source &&b) noexcept
+    {
+        body_source = std::move(b);
+        headers[field::content_type] = "application/octet-stream";
+    }
+    void set(const file_body &f) noexcept { set(requests::body_source::mapped(f.path)); }
+    void set(const requests::compression &c) noexcept { compression = c; }
+    void set(requests::compression &&c) noexcept { compression = std::move(c); }
+    void set(const text &t) noexcept { set(text{t}); }
+    void set(text &&t) noexcept { body = std::move(t); headers[field::content_type] = "text/plain"; }
+    void set(const data &d) noexcept
+    {
+        body = urlencoded(d);
+        headers[field::content_type] = "application/x-www-form-urlencoded";
+    }
+    void set(const json &j) noexcept
+    {
+    #ifdef REQUESTS_WITH_NLOHMANN_JSON
+        body = nlohmann::to_string(j);
+    #else
+        body = j;
+    #endif // REQUESTS_WITH_NLOHMANN_JSON
+        headers[field::content_type] = "application/json";
+    }
+#ifndef REQUESTS_WITH_NLOHMANN_JSON
+    // Serialized already, so it can be moved in
+    void set(json &&j) noexcept { body = std::move(j); headers[field::content_type] = "application/json"; }
+#endif // REQUESTS_WITH_NLOHMANN_JSON
+};
+
+struct response
+{
+    unsigned          status_code = 0;
+    std::string       reason;
+    requests::headers headers;
+    std::string       text;
+    std::string       error; // Transfer error, empty on success
+
+#ifdef REQUESTS_WITH_NLOHMANN_JSON
+    requests::json json() const { return nlohmann::json::parse(text); }
+#endif // REQUESTS_WITH_NLOHMANN_JSON
+};
+
+// Process-wide statistics of response::text buffers
+struct buffer_stats
+{
+    size_t presized;              // Bodies reserved up front from Content-Length
+    size_t reallocations;         // Buffer growths that still happened
+    size_t reallocations_avoided; // Growths presized bodies would have needed (estimated)
+};
+
+// TCP keep-alive probing of idle connections
+struct keep_alive
+{
+    std::chrono::seconds idle = std::chrono::seconds{60};     // Before the first probe
+    std::chrono::seconds interval = std::chrono::seconds{60}; // Between probes
+
+    bool operator==(const keep_alive &) const = default;
+};
+
+// HTTP version a session negotiates
+enum class http_version : uint8_t
+{
+    v1_1,               // HTTP/1.1 only
+    v2_tls,             // HTTP/2 over TLS through ALPN, HTTP/1.1 in cleartext (curl's default)
+    v2,                 // HTTP/2 in cleartext as well, upgrading from HTTP/1.1
+    v2_prior_knowledge, // HTTP/2 in cleartext from the start, for services known to speak it
+};
+
+// Content codings a session asks for, responses are decoded as they arrive.
+// Empty for all that curl was built with (gzip, deflate, br, zstd), "identity" for none.
+struct accept_encoding
+{
+    std::string codings;
+};
+
+// Connections used by a session's completed requests
+struct connection_stats
+{
+    size_t reused; // Sent over an already open connection
+    size_t opened; // Opened a new one
+};
+
+
+namespace detail {
+
+// Largest body buffer reserved up front from Content-Length
+constexpr size_t max_body_reserve = 64 * 1024 * 1024;
+
+// Counters behind body_buffer_stats()
+inline std::atomic<size_t> presized_bodies = 0;
+inline std::atomic<size_t> body_reallocations = 0;
+inline std::atomic<size_t> body_reallocations_avoided = 0;
+
+// Defined after transfer
+inline size_t write_callback(char *buffer, size_t size, size_t nitems, void *t);
+inline size_t header_callback(char *buffer, size_t size, size_t nitems, void *t);
+inline size_t read_callback(char *buffer, size_t size, size_t nitems, void *t);
+
+// Streaming compressor of one body
+class compressor
+{
+public:
+    explicit compressor(const compression &c) : algo_(c.algo)
+    {
+        switch (algo_)
+        {
+    #ifdef REQUESTS_WITH_ZLIB
+        case compression::gzip:
+            // Window bits above 15 select the gzip wrapper
+            ok_ = deflateInit2(&zlib_, c.level == 0 ? Z_DEFAULT_COMPRESSION : c.level,
+                               Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            break;
+    #endif // REQUESTS_WITH_ZLIB
+    #ifdef REQUESTS_WITH_ZSTD
+        case compression::zstd:
+            zstd_ = ZSTD_createCCtx();
+            ok_ = zstd_ != nullptr;
+            if (ok_ && c.dictionary) { ok_ = !ZSTD_isError(ZSTD_CCtx_refCDict(zstd_, c.dictionary->get())); }
+            else if (ok_)            { ok_ = !ZSTD_isError(ZSTD_CCtx_setParameter(zstd_, ZSTD_c_compressionLevel, c.level)); }
+            break;
+    #endif // REQUESTS_WITH_ZSTD
+        default:
+            break;
+        }
+    }
+
+    compressor(const compressor &) = delete;
+    void operator=(const compressor &) = delete;
+
+    ~compressor()
+    {
+    #ifdef REQUESTS_WITH_ZLIB
+        if (algo_ == compression::gzip && ok_) { deflateEnd(&zlib_); }
+    #endif // REQUESTS_WITH_ZLIB
+    #ifdef REQUESTS_WITH_ZSTD
+        if (algo_ == compression::zstd) { ZSTD_freeCCtx(zstd_); }
+    #endif // REQUESTS_WITH_ZSTD
+    }
+
+    // Content-Encoding of the output, empty if the algorithm isn't available
+    std::string_view encoding() const noexcept
+    {
+        switch (algo_)
+        {
+    #ifdef REQUESTS_WITH_ZLIB
+        case compression::gzip: return ok_ ? "gzip" : "";
+    #endif // REQUESTS_WITH_ZLIB
+    #ifdef REQUESTS_WITH_ZSTD
+        case compression::zstd: return ok_ ? "zstd" : "";
+    #endif // REQUESTS_WITH_ZSTD
+        default:             return "";
+        }
+    }
+
+    bool finished() const noexcept { return finished_; }
+
+    // Compresses from in (advancing it) into out and returns the bytes written, nullopt on error.
+    // With last set, in holds the rest of the body and finished() turns true once it's all out.
+    std::optional<size_t> step([[maybe_unused]] std::string_view &in,
+                               [[maybe_unused]] std::span<char> out,
+                               [[maybe_unused]] bool last)
+    {
+        switch (algo_)
+        {
+    #ifdef REQUESTS_WITH_ZLIB
+        case compression::gzip:
+        {
+            // zlib counts in 32 bits, a larger input is fed over several steps
+            constexpr size_t max = std::numeric_limits<uInt>::max();
+            zlib_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+            zlib_.avail_in = static_cast<uInt>(std::min(in.size(), max));
+            zlib_.next_out = reinterpret_cast<Bytef *>(out.data());
+            zlib_.avail_out = static_cast<uInt>(std::min(out.size(), max));
+
+            int res = deflate(&zlib_, last && in.size() <= max ? Z_FINISH : Z_NO_FLUSH);
+            if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR) { return std::nullopt; }
+
+            finished_ = res == Z_STREAM_END;
+            in.remove_prefix(static_cast<size_t>(reinterpret_cast<const char *>(zlib_.next_in) - in.data()));
+            return static_cast<size_t>(reinterpret_cast<char *>(zlib_.next_out) - out.data());
+        }
+    #endif // REQUESTS_WITH_ZLIB
+    #ifdef REQUESTS_WITH_ZSTD
+        case compression::zstd:
+        {
+            ZSTD_inBuffer input{ in.data(), in.size(), 0 };
+            ZSTD_outBuffer output{ out.data(), out.size(), 0 };
+
+            size_t left = ZSTD_compressStream2(zstd_, &output, &input, last ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(left)) { return std::nullopt; }
+
+            finished_ = last && left == 0;
+            in.remove_prefix(input.pos);
+            return output.pos;
+        }
+    #endif // REQUESTS_WITH_ZSTD
+        default:
+            return std::nullopt;
+        }
+    }
+
+private:
+    compression::algorithm algo_;
+    bool ok_ = false;
+    bool finished_ = false;
+
+#ifdef REQUESTS_WITH_ZLIB
+    z_stream zlib_ = {};
+#endif // REQUESTS_WITH_ZLIB
+#ifdef REQUESTS_WITH_ZSTD
+    ZSTD_CCtx *zstd_ = nullptr;
+#endif // REQUESTS_WITH_ZSTD
+};
+
+// Compresses the request's body or wraps its body source, and sets Content-Encoding.
+// A body that can't be compressed is sent as is.
+inline void compress_body(request &r)
+{
+    auto c = std::make_shared<compressor>(*r.compression);
+    if (c->encoding().empty()) { return; }
+
+    if (r.body_source.read)
+    {
+        // Reads are buffered, compressed output is handed out as it comes
+        struct state
+        {
+            std::shared_ptr<compressor> c;
+            std::function<std::optional<size_t>(std::span<char>)> read;
+            std::vector<char> buffer = std::vector<char>(64 * 1024);
+            std::string_view in = {};
+            bool end = false;
+        };
+
+        auto st = std::make_shared<state>(c, std::move(r.body_source.read));
+        r.body_source = { [st](std::span<char> out) -> std::optional<size_t>
+        {
+            while (!st->c->finished())
+            {
+                if (st->in.empty() && !st->end)
+                {
+                    auto n = st->read(st->buffer);
+                    if (!n) { return std::nullopt; }
 
-    void set(const requests::headers &hs) noexcept { headers = hs; }
-    void set(const query    &q) noexcept { target.query = urlencoded(q); }
-    void set(const fragment &f) noexcept { target.fragment = f; }
-    void set(const auth     &a) noexcept { headers["authorization"] = "Basic " + a.to_base64(); }
-    void set(const bearer   &b) noexcept { headers["authorization"] = "Bearer " + b.token; }
-    void set(const header   &h) noexcept { headers[h.name] = h.value; }
-    void set(const text &t) noexcept { body = t; headers["content-type"] = "text/plain"; }
-    void set(const data &d) noexcept
+                    st->end = *n == 0;
+                    st->in = { st->buffer.data(), *n };
+                }
+
+                auto n = st->c->step(st->in, out, st->end);
+                if (!n) { return std::nullopt; }
+
+                // 0 would end the body
+                if (*n > 0) { return n; }
+            }
+            return 0;
+        } };
+    }
+    else if (!r.body.empty())
     {
-        body = urlencoded(d);
-        headers["content-type"] = "application/x-www-form-urlencoded";
+        std::string_view in = r.body;
+        std::string out(in.size() / 4 + 64, '\0');
+        size_t size = 0;
+
+        while (!c->finished())
+        {
+            if (size == out.size()) { out.resize(out.size() * 2); }
+
+            auto n = c->step(in, { out.data() + size, out.size() - size }, true);
+            if (!n) { return; }
+            size += *n;
+        }
+
+        out.resize(size);
+        r.body = std::move(out);
     }
-    void set(const json &j) noexcept
+    else
     {
-    #ifdef REQUESTS_WITH_NLOHMANN_JSON
-        body = nlohmann::to_string(j);
-    #else
-        body = j;
-    #endif // REQUESTS_WITH_NLOHMANN_JSON
-        headers["content-type"] = "application/json";
+        return;
+    }
+
+    r.headers[field::content_encoding] = c->encoding();
+}
+
+// Easy handle with storage that options of its current transfer point to
+struct easy_handle
+{
+    explicit easy_handle(CURL *handler) noexcept : handler(handler) {}
+
+    easy_handle(const easy_handle &) = delete;
+    void operator=(const easy_handle &) = delete;
+
+    ~easy_handle() { curl_easy_cleanup(handler); }
+
+    CURL *handler;
+
+    // Lines and list nodes of the request's own headers, reused between transfers
+    std::string header_lines;
+    std::vector<curl_slist> header_nodes;
+
+    // How the request body is sent, switching it also resets what the other modes leave behind
+    enum class body_mode : uint8_t { none, nobody, post, upload };
+
+    void set_body_mode(body_mode mode)
+    {
+        if (mode == options_.body) { return; }
+
+        switch (mode)
+        {
+        case body_mode::none:   curl_easy_setopt(handler, CURLOPT_HTTPGET, 1L); break;
+        case body_mode::nobody: curl_easy_setopt(handler, CURLOPT_NOBODY,  1L); break;
+        case body_mode::post:   curl_easy_setopt(handler, CURLOPT_POST,    1L); break;
+        case body_mode::upload: curl_easy_setopt(handler, CURLOPT_UPLOAD,  1L); break;
+        }
+        options_.body = mode;
+    }
+
+    void set_custom_request(const char *verb)         { set(CURLOPT_CUSTOMREQUEST,       options_.custom_request, verb); }
+    void set_post_fields(const char *fields)          { set(CURLOPT_POSTFIELDS,          options_.post_fields,    fields); }
+    void set_post_size(curl_off_t size)               { set(CURLOPT_POSTFIELDSIZE_LARGE, options_.post_size,      size); }
+    void set_upload_size(curl_off_t size)             { set(CURLOPT_INFILESIZE_LARGE,    options_.upload_size,    size); }
+    void set_header_list(curl_slist *list)            { set(CURLOPT_HTTPHEADER,          options_.header_list,    list); }
+
+    void set_url(const std::string &url)
+    {
+        if (url == options_.url) { return; }
+
+        curl_easy_setopt(handler, CURLOPT_URL, url.c_str());
+        options_.url = url;
+    }
+
+    void set_keep_alive(const keep_alive &k)
+    {
+        if (k == options_.probes) { return; }
+
+        curl_easy_setopt(handler, CURLOPT_TCP_KEEPIDLE,  static_cast<long>(k.idle.count()));
+        curl_easy_setopt(handler, CURLOPT_TCP_KEEPINTVL, static_cast<long>(k.interval.count()));
+        options_.probes = k;
+    }
+
+    // HTTP/2 transfers wait for a connection they can share rather than opening another
+    void set_http_version(http_version v)
+    {
+        if (v == options_.version) { return; }
+
+        long version = CURL_HTTP_VERSION_2TLS;
+        switch (v)
+        {
+        case http_version::v1_1:               version = CURL_HTTP_VERSION_1_1;               break;
+        case http_version::v2_tls:             version = CURL_HTTP_VERSION_2TLS;              break;
+        case http_version::v2:                 version = CURL_HTTP_VERSION_2_0;               break;
+        case http_version::v2_prior_knowledge: version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE; break;
+        }
+        curl_easy_setopt(handler, CURLOPT_HTTP_VERSION, version);
+        curl_easy_setopt(handler, CURLOPT_PIPEWAIT, v == http_version::v1_1 ? 0L : 1L);
+        options_.version = v;
+    }
+
+    void set_accept_encoding(const std::string &codings)
+    {
+        if (options_.accept_encoding && codings == *options_.accept_encoding) { return; }
+
+        curl_easy_setopt(handler, CURLOPT_ACCEPT_ENCODING, codings.c_str());
+        options_.accept_encoding = codings;
+    }
+
+    // Transfer handed to the callbacks
+    void set_callback_data(void *data)
+    {
+        if (data == options_.callback_data) { return; }
+
+        curl_easy_setopt(handler, CURLOPT_HEADERDATA, data);
+        curl_easy_setopt(handler, CURLOPT_WRITEDATA,  data);
+        curl_easy_setopt(handler, CURLOPT_READDATA,   data);
+        options_.callback_data = data;
+    }
+
+private:
+    template<typename T>
+    void set(CURLoption option, T &current, T value)
+    {
+        if (value == current) { return; }
+
+        curl_easy_setopt(handler, option, value);
+        current = value;
+    }
+
+    // Options as last set on the handle, starting from curl's defaults. Pointers are
+    // compared rather than what they point to, as that is what curl keeps as well.
+    struct
+    {
+        body_mode body = body_mode::none;
+        const char *custom_request = nullptr;
+        const char *post_fields = nullptr;
+        curl_off_t post_size = -1;
+        curl_off_t upload_size = -1;
+        curl_slist *header_list = nullptr;
+        std::string url;
+        void *callback_data = nullptr;
+        keep_alive probes = {};
+        std::optional<http_version> version;
+        std::optional<std::string> accept_encoding;
+    } options_;
+};
+
+// curl_global_init for as long as handles may exist
+class curl_global
+{
+public:
+    static void init() { static curl_global g; }
+
+    curl_global(const curl_global &) = delete;
+    void operator=(const curl_global &) = delete;
+
+    ~curl_global() { curl_global_cleanup(); }
+
+private:
+    curl_global() { curl_global_init(CURL_GLOBAL_DEFAULT); }
+};
+
+// Pool of easy handles, one per session plus a process-wide one for the free functions.
+// Each handle keeps its own connection cache, so handles are handed out preferring
+// the one last used with the same origin.
+class curl_pool : public std::enable_shared_from_this<curl_pool>
+{
+public:
+    curl_pool() { curl_global::init(); }
+
+    static const std::shared_ptr<curl_pool> & get()
+    {
+        static auto cp = std::make_shared<curl_pool>();
+        return cp;
+    }
+
+    curl_pool(const curl_pool &) = delete;
+    void operator=(const curl_pool &) = delete;
+
+    // Checked out handle, returned to the pool on destruction
+    class lease
+    {
+    public:
+        lease() noexcept = default;
+        lease(std::shared_ptr<curl_pool> pool, std::unique_ptr<easy_handle> handle, std::string origin) noexcept
+            : pool_(std::move(pool)), handle_(std::move(handle)), origin_(std::move(origin)) {}
+
+        lease(lease &&other) noexcept
+            : pool_(std::move(other.pool_)),
+              handle_(std::move(other.handle_)),
+              origin_(std::move(other.origin_)) {}
+
+        lease & operator=(lease &&other) noexcept
+        {
+            std::swap(pool_, other.pool_);
+            std::swap(handle_, other.handle_);
+            std::swap(origin_, other.origin_);
+            return *this;
+        }
+
+        lease(const lease &) = delete;
+        void operator=(const lease &) = delete;
+
+        ~lease() { if (pool_ && handle_) { pool_->release(std::move(handle_), std::move(origin_)); } }
+
+        CURL * handler() const noexcept { return handle_ ? handle_->handler : nullptr; }
+
+        easy_handle & handle() const noexcept { return *handle_; }
+
+        // Count whether the completed transfer reused a connection
+        void count_connection() const noexcept
+        {
+            long opened = 0;
+            curl_easy_getinfo(handler(), CURLINFO_NUM_CONNECTS, &opened);
+            ++(opened > 0 ? pool_->opened_ : pool_->reused_);
+        }
+
+    private:
+        std::shared_ptr<curl_pool> pool_;
+        std::unique_ptr<easy_handle> handle_;
+        std::string origin_;
+    };
+
+    lease acquire(std::string_view origin)
+    {
+        std::unique_lock lock(mutex_);
+
+        if (!idle_.empty())
+        {
+            // Most recently released handle of the same origin, otherwise of any
+            auto it = std::ranges::find(idle_.rbegin(), idle_.rend(), origin, &idle_handle::origin);
+            if (it == idle_.rend()) { it = idle_.rbegin(); }
+
+            auto handle = std::move(it->handle);
+            idle_.erase(std::next(it).base());
+            handle->set_keep_alive(keep_alive_);
+            return { shared_from_this(), std::move(handle), std::string{origin} };
+        }
+
+        auto k = keep_alive_;
+        lock.unlock();
+
+        auto handle = create();
+        handle->set_keep_alive(k);
+        return { shared_from_this(), std::move(handle), std::string{origin} };
+    }
+
+    // Maximum number of idle handles kept for reuse, extra ones are closed on release
+    void max_size(size_t n)
+    {
+        std::lock_guard lock(mutex_);
+        max_size_ = n;
+        while (idle_.size() > max_size_) { idle_.erase(idle_.begin()); }
+    }
+
+    // Applies to connections opened from now on
+    void set_keep_alive(const keep_alive &k)
+    {
+        std::lock_guard lock(mutex_);
+        keep_alive_ = k;
+    }
+
+    connection_stats stats() const noexcept { return { reused_, opened_ }; }
+
+private:
+    struct idle_handle
+    {
+        std::unique_ptr<easy_handle> handle;
+        std::string origin;
+    };
+
+    static std::unique_ptr<easy_handle> create()
+    {
+        CURL *handler = curl_easy_init();
+
+        auto info = curl_version_info(CURLVERSION_NOW);
+        std::string version = "curl/" + std::string{info->version};
+        curl_easy_setopt(handler, CURLOPT_USERAGENT, version.c_str());
+        curl_easy_setopt(handler, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(handler, CURLOPT_TCP_NODELAY, 1L);
+        curl_easy_setopt(handler, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(handler, CURLOPT_MAXREDIRS, 50L);
+        curl_easy_setopt(handler, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(handler, CURLOPT_HEADERFUNCTION, header_callback);
+        curl_easy_setopt(handler, CURLOPT_READFUNCTION, read_callback);
+        curl_easy_setopt(handler, CURLOPT_CAINFO, "/etc/ssl/certs/ca-certificates.crt");
+
+        return std::make_unique<easy_handle>(handler);
+    }
+
+    void release(std::unique_ptr<easy_handle> handle, std::string origin)
+    {
+        std::lock_guard lock(mutex_);
+
+        // Extra handles are closed (on return) outside of the lock
+        if (idle_.size() >= max_size_) { return; }
+
+        idle_.push_back({ std::move(handle), std::move(origin) });
+    }
+
+    std::mutex mutex_;
+    std::vector<idle_handle> idle_;
+    size_t max_size_ = 16;
+    keep_alive keep_alive_ = {};
+
+    std::atomic<size_t> reused_ = 0;
+    std::atomic<size_t> opened_ = 0;
+};
+
+// Serialized session-wide header lines, shared by the session's transfers
+struct header_lines
+{
+    // What the lines were built from
+    headers common;
+    std::string host;
+    std::string authorization;
+
+    std::string buffer;          // "<name>: <value>" lines, each ending with '\0'
+    std::vector<size_t> offsets; // Start of each line in buffer
+    bool authorization_last;     // Last line is authorization, dropped if a request has its own
+};
+
+// Session's header lines, rebuilt only when the session's headers change. Copies share the lines.
+class header_lines_cache
+{
+public:
+    header_lines_cache() = default;
+    header_lines_cache(const header_lines_cache &other) : lines_(other.load()) {}
+
+    header_lines_cache & operator=(const header_lines_cache &other)
+    {
+        auto lines = other.load();
+        std::lock_guard lock(mutex_);
+        lines_ = std::move(lines);
+        return *this;
+    }
+
+    std::shared_ptr<const header_lines> get(const headers &common, std::string_view host, std::string_view authorization)
+    {
+        std::lock_guard lock(mutex_);
+
+        if (!lines_ || lines_->common != common || lines_->host != host || lines_->authorization != authorization)
+        {
+            lines_ = build(common, host, authorization);
+        }
+
+        return lines_;
+    }
+
+private:
+    std::shared_ptr<const header_lines> load() const
+    {
+        std::lock_guard lock(mutex_);
+        return lines_;
+    }
+
+    static std::shared_ptr<const header_lines> build(const headers &common, std::string_view host, std::string_view authorization)
+    {
+        auto res = std::make_shared<header_lines>(common, std::string{host}, std::string{authorization});
+
+        auto add = [&res](std::string_view name, std::string_view value)
+        {
+            res->offsets.push_back(res->buffer.size());
+            res->buffer.append(name).append(": ").append(value).push_back('\0');
+        };
+
+        // Common headers override the request's ones, host overrides both
+        for (const auto &[name, value] : common)
+        {
+            if (to_field(name) != field::host) { add(name, value); }
+        }
+        add(to_string(field::host), host);
+
+        res->authorization_last = !authorization.empty() && !common.contains(field::authorization);
+        if (res->authorization_last) { add(to_string(field::authorization), authorization); }
+
+        return res;
+    }
+
+    mutable std::mutex mutex_;
+    std::shared_ptr<const header_lines> lines_;
+};
+
+// Header list of the request's own headers followed by the session's lines. Built in
+// the handle's storage without allocating once it has grown, valid until its next transfer.
+inline curl_slist * header_list(easy_handle &handle, const headers &own, const header_lines &common)
+{
+    auto overridden = [&common](std::string_view name)
+    {
+        return to_field(name) == field::host || common.common.contains(name);
+    };
+
+    size_t size = 0;
+    size_t count = common.offsets.size();
+    bool own_authorization = false;
+    for (const auto &[name, value] : own)
+    {
+        if (overridden(name)) { continue; }
+
+        own_authorization |= to_field(name) == field::authorization;
+        size += name.size() + value.size() + 3;
+        ++count;
+    }
+
+    // Lines are pointed to, so the buffer must not grow while appending
+    handle.header_lines.clear();
+    handle.header_lines.reserve(size);
+    handle.header_nodes.clear();
+    handle.header_nodes.reserve(count);
+
+    for (const auto &[name, value] : own)
+    {
+        if (overridden(name)) { continue; }
+
+        char *line = handle.header_lines.data() + handle.header_lines.size();
+        handle.header_lines.append(name).append(": ").append(value).push_back('\0');
+        handle.header_nodes.push_back({ line, nullptr });
+    }
+
+    for (size_t i = 0; i < common.offsets.size(); ++i)
+    {
+        if (own_authorization && common.authorization_last && i + 1 == common.offsets.size()) { break; }
+
+        handle.header_nodes.push_back({ const_cast<char *>(common.buffer.data() + common.offsets[i]), nullptr });
+    }
+
+    if (handle.header_nodes.empty()) { return nullptr; }
+
+    for (size_t i = 0; i + 1 < handle.header_nodes.size(); ++i)
+    {
+        handle.header_nodes[i].next = &handle.header_nodes[i + 1];
+    }
+
+    return handle.header_nodes.data();
+}
+
+// Request in flight together with everything its handle points to
+struct transfer
+{
+    explicit transfer(request r) noexcept : req(std::move(r)) {}
+
+    transfer(const transfer &) = delete;
+    void operator=(const transfer &) = delete;
+
+    CURL * handler() const noexcept { return lease.handler(); }
+
+    // Collect the result once the handle is done
+    response finish(CURLcode code)
+    {
+        if (code != CURLE_OK) { res.error = curl_easy_strerror(code); }
+        else                  { lease.count_connection(); }
+
+        long response_code = 0;
+        curl_easy_getinfo(handler(), CURLINFO_RESPONSE_CODE, &response_code);
+
+        res.status_code = static_cast<unsigned>(response_code);
+
+        return std::move(res);
+    }
+
+    request req;
+    response res;
+    std::string url;
+    std::shared_ptr<const header_lines> common_headers; // Header list points into it
+    curl_pool::lease lease;
+
+    // Position of the last received response header in res.headers, for folded lines
+    std::optional<size_t> last_header;
+
+    // Called from the event loop thread (async transfers only)
+    std::function<void(response)> on_done;
+};
+
+inline size_t write_callback(char *buffer, size_t size, size_t nitems, void *t)
+{
+    auto *tr = static_cast<transfer *>(t);
+
+    if (tr->req.on_chunk)
+    {
+        // Anything but the full size makes curl abort
+        return tr->req.on_chunk(std::string_view{buffer, size * nitems}) ? size * nitems : 0;
+    }
+
+    size_t capacity = tr->res.text.capacity();
+    tr->res.text.append(static_cast<char*>(buffer), size * nitems);
+    if (tr->res.text.capacity() != capacity) { ++body_reallocations; }
+
+    return size * nitems;
+}
+
+inline size_t header_callback(char *buffer, size_t size, size_t nitems, void *t)
+{
+    auto *tr = static_cast<transfer *>(t);
+
+    std::string_view str(buffer, size * nitems);
+    while (str.ends_with('\n') || str.ends_with('\r')) { str.remove_suffix(1); }
+
+    if (str.starts_with("HTTP/"))
+    {
+        // HTTP/<version> <code> [<reason>], starts the next response after a redirect,
+        // 1xx or auth retry, so nothing of the previous one is kept
+        size_t code = str.find(' ');
+        size_t reason = code == std::string_view::npos ? code : str.find(' ', code + 1);
+        tr->res.reason = reason == std::string_view::npos ? "" : str.substr(reason + 1);
+        tr->res.headers.clear();
+        tr->res.text.clear();
+        tr->last_header.reset();
+    }
+    else if (str.starts_with(' ') || str.starts_with('\t'))
+    {
+        // Obsolete line folding continues the previous value
+        if (tr->last_header)
+        {
+            auto &value = (tr->res.headers.begin() + *tr->last_header)->second;
+            value += ' ';
+            value += trim_ows(str);
+        }
+    }
+    else if (auto [name, value] = split_header(str); !name.empty())
+    {
+        // Reserve the whole body at once, unless it goes elsewhere or never comes
+        field f = to_field(name);
+
+        if (f == field::content_length && !tr->req.on_chunk && tr->req.method != method::HEAD)
+        {
+            size_t length = 0;
+            auto [_, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+
+            if (ec == std::errc{} && length > tr->res.text.capacity())
+            {
+                tr->res.text.reserve(std::min(length, max_body_reserve));
+
+                // Growths a doubling buffer would have gone through
+                size_t growths = 0;
+                for (size_t c = 15; c < std::min(length, max_body_reserve); c *= 2) { ++growths; }
+
+                ++presized_bodies;
+                body_reallocations_avoided += growths;
+            }
+        }
+
+        auto [it, inserted] = f == field::unknown ? tr->res.headers.try_emplace(name, value)
+                                                  : tr->res.headers.try_emplace(f, value);
+        tr->last_header = inserted ? std::optional<size_t>{it - tr->res.headers.begin()} : std::nullopt;
+    }
+    return size * nitems;
+}
+
+inline size_t read_callback(char *buffer, size_t size, size_t nitems, void *t)
+{
+    auto &source = static_cast<transfer *>(t)->req.body_source;
+    if (!source.read) { return 0; }
+
+    auto n = source.read({buffer, size * nitems});
+    return n ? *n : CURL_READFUNC_ABORT;
+}
+
+// Background event loop driving transfers with curl_multi_socket_action over epoll
+class multi_loop
+{
+public:
+    static multi_loop & get()
+    {
+        static multi_loop ml;
+        return ml;
+    }
+
+    multi_loop(const multi_loop &) = delete;
+    void operator=(const multi_loop &) = delete;
+
+    void submit(std::unique_ptr<transfer> t)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            pending_.push_back(std::move(t));
+        }
+        wake();
+    }
+
+    // Streams multiplexed over one HTTP/2 connection, applied by the loop thread
+    void max_concurrent_streams(size_t n)
+    {
+        max_streams_ = std::max<size_t>(n, 1);
+        wake();
+    }
+
+    // Completion callbacks and awaiting coroutines run here, waiting on the loop from it deadlocks
+    bool on_loop_thread() const noexcept { return std::this_thread::get_id() == thread_.get_id(); }
+
+    ~multi_loop()
+    {
+        stop_ = true;
+        wake();
+        thread_.join();
+
+        // Unfinished transfers are dropped, their handles go back to the pool
+        for (const auto &[h, t] : running_) { curl_multi_remove_handle(multi_, h); }
+        running_.clear();
+        pending_.clear();
+
+        curl_multi_cleanup(multi_);
+        close(event_fd_);
+        close(epoll_fd_);
     }
-};
 
-struct response
-{
-    unsigned          status_code = 0;
-    std::string       reason;
-    requests::headers headers;
-    std::string       text;
+private:
+    multi_loop()
+    {
+        // curl_global_init must outlive the loop
+        curl_global::init();
 
-#ifdef REQUESTS_WITH_NLOHMANN_JSON
-    requests::json json() const { return nlohmann::json::parse(text); }
-#endif // REQUESTS_WITH_NLOHMANN_JSON
-};
+        multi_ = curl_multi_init();
+        curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, socket_callback);
+        curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+        curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, timer_callback);
+        curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+        curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
 
+        // Keep connections open between bursts of transfers, by default the cache
+        // shrinks with the number of transfers in flight and closes them
+        curl_multi_setopt(multi_, CURLMOPT_MAXCONNECTS, 256L);
 
-namespace detail {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
-size_t write_callback(char *buffer, size_t size, size_t nitems, void *r)
-{
-    static_cast<response *>(r)->text.append(static_cast<char*>(buffer), size * nitems);
-    return size * nitems;
-}
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = event_fd_;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
 
-size_t header_callback(char *buffer, size_t size, size_t nitems, void *r)
-{
-    std::string_view str(buffer, size * nitems - 2);
-    if (str.starts_with("HTTP"))
+        thread_ = std::thread([this]{ run(); });
+    }
+
+    void wake()
     {
-        static_cast<response *>(r)->reason = str.substr(13);
+        uint64_t one = 1;
+        [[maybe_unused]] auto n = write(event_fd_, &one, sizeof(one));
     }
-    else if (!str.empty())
+
+    static int socket_callback(CURL *, curl_socket_t s, int what, void *userp, void *socketp)
     {
-        static_cast<response *>(r)->headers.insert(header::parse(str));
+        auto *self = static_cast<multi_loop *>(userp);
+
+        if (what == CURL_POLL_REMOVE)
+        {
+            epoll_ctl(self->epoll_fd_, EPOLL_CTL_DEL, s, nullptr);
+            return 0;
+        }
+
+        epoll_event ev{};
+        if (what & CURL_POLL_IN)  { ev.events |= EPOLLIN; }
+        if (what & CURL_POLL_OUT) { ev.events |= EPOLLOUT; }
+        ev.data.fd = s;
+
+        // Sockets already watched are marked with non-null socketp
+        if (socketp)
+        {
+            epoll_ctl(self->epoll_fd_, EPOLL_CTL_MOD, s, &ev);
+        }
+        else
+        {
+            if (epoll_ctl(self->epoll_fd_, EPOLL_CTL_ADD, s, &ev) != 0 && errno == EEXIST)
+            {
+                epoll_ctl(self->epoll_fd_, EPOLL_CTL_MOD, s, &ev);
+            }
+            curl_multi_assign(self->multi_, s, self);
+        }
+
+        return 0;
     }
-    return size * nitems;
-}
 
-class curl_holder
-{
-public:
-    static curl_holder & get()
+    static int timer_callback(CURLM *, long timeout_ms, void *userp)
     {
-        static curl_holder ch;
-        return ch;
+        auto *self = static_cast<multi_loop *>(userp);
+
+        if (timeout_ms < 0) { self->deadline_.reset(); }
+        else { self->deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms); }
+
+        return 0;
     }
 
-    curl_holder(const curl_holder &) = delete;
-    void operator=(const curl_holder &) = delete;
+    void run()
+    {
+        std::array<epoll_event, 64> events;
+        int running = 0;
+
+        while (!stop_)
+        {
+            int timeout = -1;
+            if (deadline_)
+            {
+                auto left = std::chrono::ceil<std::chrono::milliseconds>(*deadline_ - std::chrono::steady_clock::now());
+                timeout = static_cast<int>(std::max<long long>(left.count(), 0));
+            }
+
+            int n = epoll_wait(epoll_fd_, events.data(), events.size(), timeout);
+
+            for (int i = 0; i < n; ++i)
+            {
+                if (events[i].data.fd == event_fd_)
+                {
+                    uint64_t count;
+                    [[maybe_unused]] auto r = read(event_fd_, &count, sizeof(count));
+                    add_pending();
+                    continue;
+                }
+
+                int mask = 0;
+                if (events[i].events & EPOLLIN)  { mask |= CURL_CSELECT_IN; }
+                if (events[i].events & EPOLLOUT) { mask |= CURL_CSELECT_OUT; }
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) { mask |= CURL_CSELECT_ERR; }
+
+                curl_multi_socket_action(multi_, events[i].data.fd, mask, &running);
+            }
+
+            if (deadline_ && *deadline_ <= std::chrono::steady_clock::now())
+            {
+                deadline_.reset();
+                curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running);
+            }
 
-    CURL * handler() const { return handler_; }
+            complete();
+        }
+    }
 
-    ~curl_holder()
+    void add_pending()
     {
-        curl_easy_cleanup(handler_);
-        curl_global_cleanup();
+        if (size_t n = max_streams_.exchange(0))
+        {
+            curl_multi_setopt(multi_, CURLMOPT_MAX_CONCURRENT_STREAMS, static_cast<long>(n));
+        }
+
+        std::vector<std::unique_ptr<transfer>> pending;
+        {
+            std::lock_guard lock(mutex_);
+            pending.swap(pending_);
+        }
+
+        for (auto &t : pending)
+        {
+            CURL *h = t->handler();
+            running_.emplace(h, std::move(t));
+            curl_multi_add_handle(multi_, h);
+        }
     }
 
-private:
-    curl_holder()
+    void complete()
     {
-        curl_global_init(CURL_GLOBAL_DEFAULT);
+        int left = 0;
+        while (CURLMsg *msg = curl_multi_info_read(multi_, &left))
+        {
+            if (msg->msg != CURLMSG_DONE) { continue; }
 
-        handler_ = curl_easy_init();
+            curl_multi_remove_handle(multi_, msg->easy_handle);
 
-        auto info = curl_version_info(CURLVERSION_NOW);
-        std::string version = "curl/" + std::string{info->version};
-        curl_easy_setopt(handler_, CURLOPT_USERAGENT, version.c_str());
-        curl_easy_setopt(handler_, CURLOPT_TCP_KEEPALIVE, 1L);
-        curl_easy_setopt(handler_, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(handler_, CURLOPT_MAXREDIRS, 50L);
-        curl_easy_setopt(handler_, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(handler_, CURLOPT_HEADERFUNCTION, header_callback);
-        curl_easy_setopt(handler_, CURLOPT_CAINFO, "/etc/ssl/certs/ca-certificates.crt");
+            auto node = running_.extract(msg->easy_handle);
+            auto on_done = std::move(node.mapped()->on_done);
+            response res = node.mapped()->finish(msg->data.result);
+
+            // Return the handle to the pool before handing the result over
+            node.mapped().reset();
+
+            if (on_done) { on_done(std::move(res)); }
+        }
+    }
+
+    CURLM *multi_ = nullptr;
+    int epoll_fd_ = -1;
+    int event_fd_ = -1;
+
+    std::optional<std::chrono::steady_clock::time_point> deadline_;
+    std::map<CURL *, std::unique_ptr<transfer>> running_;
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<transfer>> pending_;
+    std::atomic<size_t> max_streams_ = 0; // Not yet applied, 0 when there is none
+
+    std::atomic<bool> stop_ = false;
+    std::thread thread_;
+};
+
+// Submits a prepared transfer when awaited and resumes the awaiting coroutine with its response
+class response_awaiter
+{
+public:
+    explicit response_awaiter(std::unique_ptr<transfer> t) noexcept : transfer_(std::move(t)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        transfer_->on_done = [this, h](response res)
+        {
+            result_ = std::move(res);
+            h.resume();
+        };
+
+        // The transfer may complete (and resume the coroutine) before this returns
+        multi_loop::get().submit(std::move(transfer_));
     }
 
-    CURL *handler_ = nullptr;
+    response await_resume() { return std::move(result_); }
+
+private:
+    std::unique_ptr<transfer> transfer_;
+    response result_;
 };
 
 } // namespace detail
@@ -489,129 +2533,464 @@ struct session
     url origin; // scheme, host and port
     headers common_headers = {}; // Added to each request
 
-    response send(request r)
+    session(url origin = {}, headers common_headers = {})
+        : origin(std::move(origin)), common_headers(std::move(common_headers)) {}
+
+    // Session on the process-wide pool of connections, as used by the free functions
+    static session shared(url origin, headers common_headers = {})
     {
-        response res;
+        return session{ std::move(origin), std::move(common_headers), detail::curl_pool::get() };
+    }
 
-        /* Update info in the request */
-        for (const auto &[h, v] : common_headers) { r.headers[h] = v; }
-        r.headers["host"] = origin.host;
+    // Connections are kept open between requests and shared by copies of the session
+    void set(const keep_alive &k)    { pool_->set_keep_alive(k); }
 
+    // Concurrent async requests share an HTTP/2 connection when one is negotiated
+    void set(http_version v) noexcept { version_ = v; }
 
-        CURL *curl = detail::curl_holder::get().handler();
+    // Compressed responses are decoded before reaching response::text or on_chunk
+    void set(accept_encoding a) noexcept { accept_encoding_ = std::move(a); }
+    void max_connections(size_t n)   { pool_->max_size(n); }
 
-        switch (r.method)
-        {
-        case method::DELETE:  curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");  break;
-        case method::GET:     curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);              break;
-        case method::HEAD:    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");    break;
-        case method::POST:
-            curl_easy_setopt(curl, CURLOPT_POST, 1L);
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, r.body.c_str());
-            break;
-        case method::PUT:     curl_easy_setopt(curl, CURLOPT_PUT, 1L);                  break;
-        case method::OPTIONS: curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "OPTIONS"); break;
-        case method::PATCH:   curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PATCH");   break;
-        }
+    connection_stats connections() const noexcept { return pool_->stats(); }
+
+    // Authorize each request of the session (unless it has its own authorization).
+    // The header is encoded only when credentials change.
+    void authorize(const auth &a)
+    {
+        if (auto *c = std::get_if<auth>(&credentials_); c && *c == a) { return; }
+        credentials_ = a;
+        authorization_ = "Basic " + a.to_base64();
+    }
+
+    void authorize(const bearer &b)
+    {
+        if (auto *c = std::get_if<bearer>(&credentials_); c && *c == b) { return; }
+        credentials_ = b;
+        authorization_ = "Bearer " + b.token;
+    }
+
+    void deauthorize() noexcept
+    {
+        credentials_ = std::monostate{};
+        authorization_.clear();
+    }
+
+    response send(request r) { return perform(r, r.target.resource()); }
+
+    // Send to a resource given by view, query and fragment options override the view's ones
+    response send(request r, url_view target)
+    {
+        if (r.target.query.empty() && r.target.fragment.empty()) { return perform(r, target.resource()); }
+
+        r.target.path = target.path();
+        if (r.target.query.empty())    { r.target.query    = target.query(); }
+        if (r.target.fragment.empty()) { r.target.fragment = target.fragment(); }
+
+        return perform(r, r.target.resource());
+    }
+
+    template<concepts::option ...Args>
+    response delet(const url &target, Args && ...args)
+    {
+        return send(construct_request(method::DELETE, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    response get(const url &target, Args && ...args)
+    {
+        return send(construct_request(method::GET, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    response head(const url &target, Args && ...args)
+    {
+        return send(construct_request(method::HEAD, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    response options(const url &target, Args && ...args)
+    {
+        return send(construct_request(method::OPTIONS, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    response patch(const url &target, Args && ...args)
+    {
+        return send(construct_request(method::PATCH, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    response post(const url &target, Args && ...args)
+    {
+        return send(construct_request(method::POST, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    response put(const url &target, Args && ...args)
+    {
+        return send(construct_request(method::PUT, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    response delet(url_view target, Args && ...args)
+    {
+        return send(construct_request(method::DELETE, {}, std::forward<Args>(args)...), target);
+    }
+
+    template<concepts::option ...Args>
+    response get(url_view target, Args && ...args)
+    {
+        return send(construct_request(method::GET, {}, std::forward<Args>(args)...), target);
+    }
+
+    template<concepts::option ...Args>
+    response head(url_view target, Args && ...args)
+    {
+        return send(construct_request(method::HEAD, {}, std::forward<Args>(args)...), target);
+    }
+
+    template<concepts::option ...Args>
+    response options(url_view target, Args && ...args)
+    {
+        return send(construct_request(method::OPTIONS, {}, std::forward<Args>(args)...), target);
+    }
+
+    template<concepts::option ...Args>
+    response patch(url_view target, Args && ...args)
+    {
+        return send(construct_request(method::PATCH, {}, std::forward<Args>(args)...), target);
+    }
+
+    template<concepts::option ...Args>
+    response post(url_view target, Args && ...args)
+    {
+        return send(construct_request(method::POST, {}, std::forward<Args>(args)...), target);
+    }
+
+    template<concepts::option ...Args>
+    response put(url_view target, Args && ...args)
+    {
+        return send(construct_request(method::PUT, {}, std::forward<Args>(args)...), target);
+    }
+
+    // Send without blocking, on_done is called from the event loop thread
+    void async_send(request r, std::function<void(response)> on_done)
+    {
+        auto t = make_transfer(std::move(r));
+        t->on_done = std::move(on_done);
+
+        detail::multi_loop::get().submit(std::move(t));
+    }
+
+    // The future is completed by the event loop, so it must not be waited on from the loop
+    // thread (in on_done or a coroutine resumed by co_send), only from other threads
+    std::future<response> async_send(request r)
+    {
+        auto p = std::make_shared<std::promise<response>>();
+        auto f = p->get_future();
+        async_send(std::move(r), [p](response res){ p->set_value(std::move(res)); });
+        return f;
+    }
+
+    template<concepts::option ...Args>
+    std::future<response> async_delet(const url &target, Args && ...args)
+    {
+        return async_send(construct_request(method::DELETE, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    std::future<response> async_get(const url &target, Args && ...args)
+    {
+        return async_send(construct_request(method::GET, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    std::future<response> async_head(const url &target, Args && ...args)
+    {
+        return async_send(construct_request(method::HEAD, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    std::future<response> async_options(const url &target, Args && ...args)
+    {
+        return async_send(construct_request(method::OPTIONS, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    std::future<response> async_patch(const url &target, Args && ...args)
+    {
+        return async_send(construct_request(method::PATCH, target, std::forward<Args>(args)...));
+    }
+
+    template<concepts::option ...Args>
+    std::future<response> async_post(const url &target, Args && ...args)
+    {
+        return async_send(construct_request(method::POST, target, std::forward<Args>(args)...));
+    }
 
-        std::string url = origin.origin() + r.target.resource();
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    template<concepts::option ...Args>
+    std::future<response> async_put(const url &target, Args && ...args)
+    {
+        return async_send(construct_request(method::PUT, target, std::forward<Args>(args)...));
+    }
 
-        curl_slist *curl_headers = nullptr;
-        for (const auto &[h, v] : r.headers)
+    // Send a batch over the event loop with at most max_in_flight transfers at a time.
+    // Responses are in the order of requests, failed ones have response::error set.
+    // Requests are moved from and left default-constructed. Blocks until all are done, so it
+    // must not be called from the event loop thread.
+    std::vector<response> send_all(std::span<request> rs, size_t max_in_flight = 16)
+    {
+        if (detail::multi_loop::get().on_loop_thread())
         {
-            curl_headers = curl_slist_append(curl_headers, (h + ": " + v).c_str());
+            throw std::logic_error("requests::session::send_all: blocking on the event loop thread");
         }
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, curl_headers);
 
+        struct batch
+        {
+            session &s;
+            std::span<request> rs;
+            std::vector<response> res;
 
-        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &res);
+            std::mutex mutex = {};
+            std::condition_variable cv = {};
+            size_t next = 0;
+            size_t done = 0;
 
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA,  &res);
+            void launch(size_t i)
+            {
+                s.async_send(std::exchange(rs[i], request{}), [this, i](response r)
+                {
+                    res[i] = std::move(r);
+
+                    // The batch may be gone once the last one is counted, so decide under the lock
+                    std::optional<size_t> n;
+                    {
+                        std::lock_guard lock(mutex);
+                        if (next < rs.size()) { n = next++; }
+                        if (++done == rs.size()) { cv.notify_one(); }
+                    }
+
+                    if (n) { launch(*n); }
+                });
+            }
+        };
 
-        curl_easy_perform(curl);
-        curl_slist_free_all(curl_headers);
+        batch b{ *this, rs, std::vector<response>(rs.size()) };
 
-        long response_code;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+        size_t first = std::min(std::max<size_t>(max_in_flight, 1), rs.size());
+        b.next = first;
+        for (size_t i = 0; i < first; ++i) { b.launch(i); }
 
-        res.status_code = static_cast<unsigned>(response_code);
+        std::unique_lock lock(b.mutex);
+        b.cv.wait(lock, [&b]{ return b.done == b.rs.size(); });
 
-        return res;
+        return std::move(b.res);
     }
 
+    // Awaitable send, the coroutine is resumed on the event loop thread. Until it suspends
+    // again it holds up every other transfer, and blocking there on send_all, a future from
+    // async_send or another sync wait on the loop never returns.
+    detail::response_awaiter co_send(request r) { return detail::response_awaiter{make_transfer(std::move(r))}; }
+
     template<concepts::option ...Args>
-    response delet(const url &target, const Args & ...args)
+    detail::response_awaiter co_delet(const url &target, Args && ...args)
     {
-        return send(construct_request(method::DELETE, target, args...));
+        return co_send(construct_request(method::DELETE, target, std::forward<Args>(args)...));
     }
 
     template<concepts::option ...Args>
-    response get(const url &target, const Args & ...args)
+    detail::response_awaiter co_get(const url &target, Args && ...args)
     {
-        return send(construct_request(method::GET, target, args...));
+        return co_send(construct_request(method::GET, target, std::forward<Args>(args)...));
     }
 
     template<concepts::option ...Args>
-    response head(const url &target, const Args & ...args)
+    detail::response_awaiter co_head(const url &target, Args && ...args)
     {
-        return send(construct_request(method::HEAD, target, args...));
+        return co_send(construct_request(method::HEAD, target, std::forward<Args>(args)...));
     }
 
     template<concepts::option ...Args>
-    response options(const url &target, const Args & ...args)
+    detail::response_awaiter co_options(const url &target, Args && ...args)
     {
-        return send(construct_request(method::OPTIONS, target, args...));
+        return co_send(construct_request(method::OPTIONS, target, std::forward<Args>(args)...));
     }
 
     template<concepts::option ...Args>
-    response patch(const url &target, const Args & ...args)
+    detail::response_awaiter co_patch(const url &target, Args && ...args)
     {
-        return send(construct_request(method::PATCH, target, args...));
+        return co_send(construct_request(method::PATCH, target, std::forward<Args>(args)...));
     }
 
     template<concepts::option ...Args>
-    response post(const url &target, const Args & ...args)
+    detail::response_awaiter co_post(const url &target, Args && ...args)
     {
-        return send(construct_request(method::POST, target, args...));
+        return co_send(construct_request(method::POST, target, std::forward<Args>(args)...));
     }
 
     template<concepts::option ...Args>
-    response put(const url &target, const Args & ...args)
+    detail::response_awaiter co_put(const url &target, Args && ...args)
     {
-        return send(construct_request(method::PUT, target, args...));
+        return co_send(construct_request(method::PUT, target, std::forward<Args>(args)...));
     }
 
 private:
+    session(url origin, headers common_headers, std::shared_ptr<detail::curl_pool> pool)
+        : origin(std::move(origin)), common_headers(std::move(common_headers)), pool_(std::move(pool)) {}
+
+    response perform(request &r, std::string_view resource)
+    {
+        detail::transfer t{std::move(r)};
+        prepare(t, resource);
+
+        return t.finish(curl_easy_perform(t.handler()));
+    }
+
+    std::unique_ptr<detail::transfer> make_transfer(request r) const
+    {
+        std::string resource = r.target.resource();
+
+        auto t = std::make_unique<detail::transfer>(std::move(r));
+        prepare(*t, resource);
+
+        return t;
+    }
+
+    static curl_off_t size_or_unknown(std::optional<size_t> size) noexcept
+    {
+        return size ? static_cast<curl_off_t>(*size) : -1;
+    }
+
+    // Check out a handle and apply the request to it
+    void prepare(detail::transfer &t, std::string_view resource) const
+    {
+        request &r = t.req;
+
+        t.url = origin.origin();
+        t.lease = pool_->acquire(t.url);
+        t.url += resource;
+
+        if (r.compression) { detail::compress_body(r); }
+
+        detail::easy_handle &h = t.lease.handle();
+        using mode = detail::easy_handle::body_mode;
+
+        switch (r.method)
+        {
+        case method::DELETE:  h.set_custom_request("DELETE");  h.set_body_mode(mode::none);   break;
+        case method::GET:     h.set_custom_request(nullptr);   h.set_body_mode(mode::none);   break;
+        case method::HEAD:    h.set_custom_request(nullptr);   h.set_body_mode(mode::nobody); break;
+        case method::OPTIONS: h.set_custom_request("OPTIONS"); h.set_body_mode(mode::none);   break;
+        case method::POST:
+            h.set_custom_request(nullptr);
+            set_body(h, r);
+            break;
+        case method::PUT:
+            if (!r.body_source.read) { r.body_source = body_source::memory(r.body); }
+            h.set_custom_request(nullptr);
+            set_body(h, r);
+            break;
+        case method::PATCH:
+            h.set_custom_request("PATCH");
+            if (r.body_source.read || !r.body_source.region.empty() || !r.body.empty()) { set_body(h, r); }
+            else { h.set_body_mode(mode::none); }
+            break;
+        }
+
+        h.set_url(t.url);
+        h.set_http_version(version_);
+        h.set_accept_encoding(accept_encoding_.codings);
+
+        // Session's headers override the request's ones
+        t.common_headers = header_lines_.get(common_headers, origin.host, authorization_);
+        h.set_header_list(detail::header_list(h, r.headers, *t.common_headers));
+
+        h.set_callback_data(&t);
+    }
+
+    // Body of a request that has one: read from its source when uploading, from memory when posting
+    static void set_body(detail::easy_handle &h, const request &r)
+    {
+        using mode = detail::easy_handle::body_mode;
+
+        if (r.method == method::PUT || (r.method == method::PATCH && r.body_source.read))
+        {
+            h.set_body_mode(mode::upload);
+            h.set_upload_size(size_or_unknown(r.body_source.size));
+            return;
+        }
+
+        h.set_body_mode(mode::post);
+        if (!r.body_source.region.empty())
+        {
+            h.set_post_size(static_cast<curl_off_t>(r.body_source.region.size()));
+            h.set_post_fields(r.body_source.region.data());
+        }
+        else if (r.body_source.read)
+        {
+            // Size -1 makes curl send it chunked
+            h.set_post_fields(nullptr);
+            h.set_post_size(size_or_unknown(r.body_source.size));
+        }
+        else
+        {
+            h.set_post_size(static_cast<curl_off_t>(r.body.size()));
+            h.set_post_fields(r.body.c_str());
+        }
+    }
+
     template<concepts::option ...Args>
-    request construct_request(method m, const url &target, const Args & ...args) const
+    request construct_request(method m, const url &target, Args && ...args) const
     {
         request r{ m, target, {{"user-agent", "requests"}}, "" };
-        r.set(args...);
+        r.set(std::forward<Args>(args)...);
         return r;
     }
+
+    std::variant<std::monostate, auth, bearer> credentials_;
+    std::string authorization_; // Encoded credentials_
+
+    mutable detail::header_lines_cache header_lines_;
+
+    std::shared_ptr<detail::curl_pool> pool_ = std::make_shared<detail::curl_pool>();
+    http_version version_ = http_version::v2_tls;
+    accept_encoding accept_encoding_ = {};
 };
 
 
+// Idle connections kept warm for reuse by the free functions (16 by default)
+inline void max_pooled_connections(size_t n) { detail::curl_pool::get()->max_size(n); }
+
+// Streams of async requests multiplexed over one HTTP/2 connection (100 by default)
+inline void max_concurrent_streams(size_t n) { detail::multi_loop::get().max_concurrent_streams(n); }
+
+
+inline buffer_stats body_buffer_stats() noexcept
+{
+    return { detail::presized_bodies, detail::body_reallocations, detail::body_reallocations_avoided };
+}
+
+
 template<concepts::option ...Args>
-response delet(const url &url, const Args &...args)   { return session{url}.delet(url, args...); }
+response delet(const url &url, Args &&...args)   { return session::shared(url).delet(url, std::forward<Args>(args)...); }
 
 template<concepts::option ...Args>
-response get(const url &url, const Args &...args)     { return session{url}.get(url, args...); }
+response get(const url &url, Args &&...args)     { return session::shared(url).get(url, std::forward<Args>(args)...); }
 
 template<concepts::option ...Args>
-response head(const url &url, const Args &...args)    { return session{url}.head(url, args...); }
+response head(const url &url, Args &&...args)    { return session::shared(url).head(url, std::forward<Args>(args)...); }
 
 template<concepts::option ...Args>
-response options(const url &url, const Args &...args) { return session{url}.options(url, args...); }
+response options(const url &url, Args &&...args) { return session::shared(url).options(url, std::forward<Args>(args)...); }
 
 template<concepts::option ...Args>
-response patch(const url &url, const Args &...args)   { return session{url}.patch(url, args...); }
+response patch(const url &url, Args &&...args)   { return session::shared(url).patch(url, std::forward<Args>(args)...); }
 
 template<concepts::option ...Args>
-response post(const url &url, const Args &...args)    { return session{url}.post(url, args...); }
+response post(const url &url, Args &&...args)    { return session::shared(url).post(url, std::forward<Args>(args)...); }
 
 template<concepts::option ...Args>
-response put(const url &url, const Args & ...args)    { return session{url}.put(url, args...); }
+response put(const url &url, Args &&...args)     { return session::shared(url).put(url, std::forward<Args>(args)...); }
 
 } // namespace requests
\ No newline at end of file